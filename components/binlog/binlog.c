@@ -0,0 +1,158 @@
+//
+//  binlog.c
+//  pid-controller-server
+//
+//  Deferred binary logger: call sites only store a fixed-size record (timestamp, event id, 3 integer arguments) into
+//  a lock-free ring buffer, the text is produced later by a low-priority task (or by whoever drains the records)
+//
+
+#include <stdio.h>
+
+#include "binlog.h"
+
+
+#if (CONFIG_BINLOG_RING_LEN & (CONFIG_BINLOG_RING_LEN - 1)) != 0
+#error "CONFIG_BINLOG_RING_LEN must be a power of 2"
+#endif
+#define BINLOG_RING_MASK (CONFIG_BINLOG_RING_LEN - 1)
+
+#define BINLOG_TASK_PRIORITY 1  // only above the idle task: formatting and UART output happen when nothing else runs
+#define BINLOG_TASK_STACK_SIZE 3072
+#define BINLOG_TASK_PERIOD_MS 50
+#define BINLOG_TASK_BATCH 16
+
+
+#define BINLOG_EVENT_NAME(id, format) #id,
+static const char *const event_names[BINLOG_EVENT_COUNT] = { BINLOG_EVENTS(BINLOG_EVENT_NAME) };
+#undef BINLOG_EVENT_NAME
+
+#define BINLOG_EVENT_FORMAT(id, format) format,
+static const char *const event_formats[BINLOG_EVENT_COUNT] = { BINLOG_EVENTS(BINLOG_EVENT_FORMAT) };
+#undef BINLOG_EVENT_FORMAT
+
+
+/*
+ *  Bounded multi-producer ring (sequence per slot). Position p maps to slot p & MASK, which is free for a writer when
+ *  its sequence equals p, holds a committed record when it equals p + 1 and becomes free for the next lap (p + LEN)
+ *  once read. The stored value is the sequence minus the slot index so the zero-initialized ring is valid before any
+ *  init code runs. Writers never wait: a full ring drops the new record and counts it
+ */
+typedef struct binlog_slot {
+    uint32_t seq;
+    binlog_record_t record;
+} binlog_slot_t;
+
+static binlog_slot_t ring[CONFIG_BINLOG_RING_LEN];
+static uint32_t head = 0;  // next position to be reserved by a writer
+static uint32_t tail = 0;  // next position to be read, only touched by the (single) reader
+static uint32_t dropped = 0;
+
+
+static inline uint32_t IRAM_ATTR _slot_seq(uint32_t idx) {
+    return __atomic_load_n(&ring[idx].seq, __ATOMIC_ACQUIRE) + idx;
+}
+
+static inline void IRAM_ATTR _slot_set_seq(uint32_t idx, uint32_t seq) {
+    __atomic_store_n(&ring[idx].seq, seq - idx, __ATOMIC_RELEASE);
+}
+
+
+void IRAM_ATTR binlog_write(uint8_t level, uint16_t event, uint32_t a0, uint32_t a1, uint32_t a2) {
+
+    uint32_t pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    while (1) {
+        int32_t const diff = (int32_t)(_slot_seq(pos & BINLOG_RING_MASK) - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+            // pos has been reloaded by the failed exchange
+        }
+        else if (diff < 0) {  // the slot still holds a record from the previous lap: full
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        else {  // another writer has taken this position
+            pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+        }
+    }
+
+    binlog_record_t *record = &ring[pos & BINLOG_RING_MASK].record;
+    record->timestamp_us = (uint32_t)esp_timer_get_time();
+    record->event = event;
+    record->level = level;
+    record->args[0] = a0;
+    record->args[1] = a1;
+    record->args[2] = a2;
+
+    _slot_set_seq(pos & BINLOG_RING_MASK, pos + 1);
+}
+
+
+/*
+ *  Move up to max committed records out of the ring, oldest first. Returns their number. There must be a single reader
+ *  (the binlog task once started)
+ */
+int binlog_read(binlog_record_t *records, int max) {
+    int n = 0;
+    while (n < max) {
+        uint32_t const idx = tail & BINLOG_RING_MASK;
+        if ((int32_t)(_slot_seq(idx) - (tail + 1)) < 0) {  // not committed yet
+            break;
+        }
+        records[n++] = ring[idx].record;
+        _slot_set_seq(idx, tail + CONFIG_BINLOG_RING_LEN);
+        tail++;
+    }
+    return n;
+}
+
+uint32_t binlog_get_dropped(void) {
+    return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
+
+const char *binlog_event_name(uint16_t event) {
+    return (event < BINLOG_EVENT_COUNT) ? event_names[event] : "?";
+}
+
+const char *binlog_event_format(uint16_t event) {
+    return (event < BINLOG_EVENT_COUNT) ? event_formats[event] : "?";
+}
+
+
+static void _binlog_task(void *data) {
+
+    static const char level_letters[] = { 'N', 'E', 'W', 'I', 'D' };
+    binlog_record_t records[BINLOG_TASK_BATCH];
+    uint32_t dropped_reported = 0;
+
+    while (1) {
+        int n;
+        while ((n = binlog_read(records, BINLOG_TASK_BATCH)) > 0) {
+            for (int i = 0; i < n; i++) {
+                char text[96];
+                snprintf(text, sizeof(text), binlog_event_format(records[i].event), records[i].args[0],
+                         records[i].args[1], records[i].args[2]);
+                printf("%c (%u) binlog: %s\n", level_letters[records[i].level % sizeof(level_letters)],
+                       records[i].timestamp_us / 1000, text);
+            }
+            fflush(stdout);
+        }
+
+        uint32_t const dropped_now = binlog_get_dropped();
+        if (dropped_now != dropped_reported) {
+            printf("W binlog: %u record(s) dropped\n", dropped_now - dropped_reported);
+            fflush(stdout);
+            dropped_reported = dropped_now;
+        }
+
+        vTaskDelay(pdMS_TO_TICKS(BINLOG_TASK_PERIOD_MS));
+    }
+}
+
+/*
+ *  Start the task printing the records. Not needed if the records are drained (and formatted) elsewhere
+ */
+void binlog_start(void) {
+    xTaskCreate(_binlog_task, "_binlog_task", BINLOG_TASK_STACK_SIZE, NULL, BINLOG_TASK_PRIORITY, NULL);
+}
@@ -0,0 +1,102 @@
+//
+//  binlog.h
+//  pid-controller-server
+//
+//  Deferred binary logger: call sites only store a fixed-size record (timestamp, event id, 3 integer arguments) into
+//  a lock-free ring buffer, the text is produced later by a low-priority task (or by whoever drains the records)
+//
+
+#ifndef binlog_h
+#define binlog_h
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sdkconfig.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_timer.h"
+#include "esp_attr.h"
+
+
+#define BINLOG_LEVEL_NONE 0
+#define BINLOG_LEVEL_ERROR 1
+#define BINLOG_LEVEL_WARN 2
+#define BINLOG_LEVEL_INFO 3
+#define BINLOG_LEVEL_DEBUG 4
+
+#define BINLOG_ARGS 3
+
+
+/*
+ *  Every event of the firmware with the format of its arguments (integers only: the record keeps their values, not
+ *  pointers to them)
+ */
+#define BINLOG_EVENTS(X) \
+    X(BINLOG_EV_REQUEST, "request: write %u, id %u, result %u") \
+    X(BINLOG_EV_REQUEST_REJECTED, "unknown or incorrect request: write %u, id %u") \
+    X(BINLOG_EV_REQUEST_MALFORMED, "malformed v2 request: %u bytes, len %u, loop %u")
+
+#define BINLOG_EVENT_ENUM(id, format) id,
+enum {
+    BINLOG_EVENTS(BINLOG_EVENT_ENUM)
+    BINLOG_EVENT_COUNT
+};
+#undef BINLOG_EVENT_ENUM
+
+
+typedef struct binlog_record {
+    uint32_t timestamp_us;  // esp_timer time, wraps every ~71 minutes
+    uint16_t event;
+    uint8_t level;
+    uint8_t _reserved;
+    uint32_t args[BINLOG_ARGS];
+} binlog_record_t;
+
+
+/*
+ *  Log an event with up to BINLOG_ARGS integer arguments. BINLOG_E() and friends of the levels above
+ *  CONFIG_BINLOG_LEVEL expand to nothing, arguments included, like the ESP_LOG macros
+ */
+#define BINLOG(level, event, ...) \
+    _BINLOG_WRITE((level), (event), ##__VA_ARGS__, 0, 0, 0)
+
+#define _BINLOG_WRITE(level, event, a0, a1, a2, ...) \
+    binlog_write((level), (event), (uint32_t)(a0), (uint32_t)(a1), (uint32_t)(a2))
+
+#if CONFIG_BINLOG_LEVEL >= BINLOG_LEVEL_ERROR
+#define BINLOG_E(event, ...) BINLOG(BINLOG_LEVEL_ERROR, (event), ##__VA_ARGS__)
+#else
+#define BINLOG_E(event, ...) do { } while (0)
+#endif
+#if CONFIG_BINLOG_LEVEL >= BINLOG_LEVEL_WARN
+#define BINLOG_W(event, ...) BINLOG(BINLOG_LEVEL_WARN, (event), ##__VA_ARGS__)
+#else
+#define BINLOG_W(event, ...) do { } while (0)
+#endif
+#if CONFIG_BINLOG_LEVEL >= BINLOG_LEVEL_INFO
+#define BINLOG_I(event, ...) BINLOG(BINLOG_LEVEL_INFO, (event), ##__VA_ARGS__)
+#else
+#define BINLOG_I(event, ...) do { } while (0)
+#endif
+#if CONFIG_BINLOG_LEVEL >= BINLOG_LEVEL_DEBUG
+#define BINLOG_D(event, ...) BINLOG(BINLOG_LEVEL_DEBUG, (event), ##__VA_ARGS__)
+#else
+#define BINLOG_D(event, ...) do { } while (0)
+#endif
+
+
+void binlog_write(uint8_t level, uint16_t event, uint32_t a0, uint32_t a1, uint32_t a2);
+
+int binlog_read(binlog_record_t *records, int max);
+uint32_t binlog_get_dropped(void);
+const char *binlog_event_name(uint16_t event);
+const char *binlog_event_format(uint16_t event);
+
+void binlog_start(void);
+
+
+#endif /* binlog_h */
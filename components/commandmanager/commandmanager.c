@@ -22,90 +22,554 @@
 // }
 
 
-// simulate a real system when streaming data will be stored in a separate array and probably will be collected in
-// another thread. Therefore in this case there should be some locking mechanism (mutex)
-static float stream_values[2];
+// sender of the request being processed, for the commands acting on behalf of the client (stream subscription)
+static const struct sockaddr *request_addr;
+static socklen_t request_addr_len;
 
 
-#define STREAM_BUF_SIZE (sizeof(char)+2*sizeof(float))
-#define STREAM_THREAD_SLEEP_TIME_MS 20
+static int _validate_finite(const float *values) {
+    return isfinite(values[0]) ? RESULT_ok : RESULT_error;
+}
+
+static int _validate_limits(const float *values) {
+    return (isfinite(values[0]) && isfinite(values[1]) && (values[0] <= values[1])) ? RESULT_ok : RESULT_error;
+}
+
+
+static int _schedule_write(const unsigned char *payload, int payload_len) {
+
+    PIDschedule schedule;
+    PID_ScheduleInit(&schedule);
+
+    if ((payload_len >= 1) && (payload[0] != PID_SCHEDULE_OFF)) {
+        if (payload_len < SCHEDULE_PAYLOAD_HEADER_SIZE) {
+            return RESULT_error;
+        }
+        int const points = payload[1];
+        float range[2];
+        float gains[PID_SCHEDULE_POINTS_MAX*3];
+        memcpy(range, &payload[2], 2*sizeof(float));
+        if ((points > PID_SCHEDULE_POINTS_MAX) ||
+            (payload_len != SCHEDULE_PAYLOAD_HEADER_SIZE + points*3*sizeof(float))) {
+            return RESULT_error;
+        }
+        memcpy(gains, &payload[SCHEDULE_PAYLOAD_HEADER_SIZE], points*3*sizeof(float));
+        if (!PID_ScheduleSet(&schedule, payload[0], range[0], range[1], points, gains)) {
+            return RESULT_error;
+        }
+    }
+
+    return (controlloop_set_schedule(&schedule) == ESP_OK) ? RESULT_ok : RESULT_error;
+}
+
+static int _schedule_read(unsigned char *payload) {
+
+    PIDschedule schedule;
+    controlloop_get_schedule(&schedule);
+
+    int const points = (schedule.source != PID_SCHEDULE_OFF) ? schedule.points : 0;
+    float const range[2] = { schedule.x_min, schedule.x_max };
+    payload[0] = schedule.source;
+    payload[1] = points;
+    memcpy(&payload[2], range, 2*sizeof(float));
+    memcpy(&payload[SCHEDULE_PAYLOAD_HEADER_SIZE], schedule.gains, points*3*sizeof(float));
+
+    return SCHEDULE_PAYLOAD_HEADER_SIZE + points*3*sizeof(float);
+}
+
+
+static int _cascade_write(const unsigned char *payload, int payload_len) {
+
+    static controlloop_cascade_t cascade;  // too large for the stack of udp_server_task
+
+    int const n = (payload_len >= 1) ? payload[0] : 0;
+    if ((PID_CascadeInit(&cascade.pid, n) < 0) ||
+        (payload_len != (int)(sizeof(uint8_t) + n*CASCADE_STAGE_PAYLOAD_SIZE))) {
+        return RESULT_error;
+    }
+
+    uint16_t dividers[PID_CASCADE_STAGES_MAX];
+    for (int i = 0; i < n; i++) {
+        unsigned char const *stage_payload = &payload[sizeof(uint8_t) + i*CASCADE_STAGE_PAYLOAD_SIZE];
+        float values[8];  // setpoint, kP, kI, kD, Perr limits, Ierr limits
+        cascade.pv_channel[i] = stage_payload[0];
+        memcpy(&dividers[i], &stage_payload[1], sizeof(uint16_t));
+        memcpy(values, &stage_payload[3], sizeof(values));
+        // the same checks as for the single loop's variables
+        for (int v = 0; v < 4; v++) {
+            if (_validate_finite(&values[v]) != RESULT_ok) {
+                return RESULT_error;
+            }
+        }
+        if ((_validate_limits(&values[4]) != RESULT_ok) || (_validate_limits(&values[6]) != RESULT_ok)) {
+            return RESULT_error;
+        }
+
+        PID_Coefficients(&cascade.pid.stage[i], values[0], values[1], values[2], values[3]);
+        PID_SetLimitsPerr(&cascade.pid.stage[i], values[4], values[5]);
+        PID_SetLimitsIerr(&cascade.pid.stage[i], values[6], values[7]);
+        PID_ResetIerr(&cascade.pid.stage[i]);
+    }
+    if (!PID_CascadeSetDividers(&cascade.pid, dividers)) {
+        return RESULT_error;
+    }
+
+    return (controlloop_set_cascade(&cascade) == ESP_OK) ? RESULT_ok : RESULT_error;
+}
+
+static int _cascade_read(unsigned char *payload) {
+
+    static controlloop_cascade_t cascade;
+    controlloop_get_cascade(&cascade);
+
+    payload[0] = cascade.pid.n;
+    for (int i = 0; i < cascade.pid.n; i++) {
+        unsigned char *stage_payload = &payload[sizeof(uint8_t) + i*CASCADE_STAGE_PAYLOAD_SIZE];
+        PIDdata const *stage = &cascade.pid.stage[i];
+        float const values[8] = {
+            PID_VALUE_TO_FLOAT(stage->setpoint),
+            PID_GAIN_TO_FLOAT(stage->kP), PID_GAIN_TO_FLOAT(stage->kI), PID_GAIN_TO_FLOAT(stage->kD),
+            PID_VALUE_TO_FLOAT(stage->Perrmin), PID_VALUE_TO_FLOAT(stage->Perrmax),
+            PID_VALUE_TO_FLOAT(stage->Ierrmin), PID_VALUE_TO_FLOAT(stage->Ierrmax)
+        };
+        stage_payload[0] = cascade.pv_channel[i];
+        memcpy(&stage_payload[1], &cascade.pid.divider[i], sizeof(uint16_t));
+        memcpy(&stage_payload[3], values, sizeof(values));
+    }
+
+    return sizeof(uint8_t) + cascade.pid.n*CASCADE_STAGE_PAYLOAD_SIZE;
+}
+
+
+/*
+ *  Plain variables are floats addressed by their offset in this view. Reads fill it from the live pid_data, writes
+ *  from the last published parameter set; a written err_I (which can only be zeroed) turns into an integral reset
+ *  published along with the parameters
+ */
+typedef struct vars_view {
+    controlloop_params_t params;
+    float err_I;
+} vars_view_t;
+
+#define VAR_PLAIN(member) offsetof(vars_view_t, member)
+
+
+static int _validate_zero(const float *values) {
+    return (values[0] == 0.0f) ? RESULT_ok : RESULT_error;
+}
+
+
+static int _stream_stop_cmd(unsigned char *payload) {
+    stream_stop((const struct sockaddr *)request_addr);
+    return 0;
+}
+
+static int _stream_start_cmd(unsigned char *payload) {
+    return (stream_start((const struct sockaddr *)request_addr, request_addr_len) == ESP_OK) ? 0 : -1;
+}
+
+static int _stream_config_write(const unsigned char *payload, int payload_len) {
+    stream_config_t config;
+    memset(&config, 0, sizeof(config));
+    memcpy(&config, payload, MIN(payload_len, (int)sizeof(config)));
+    // the fields a client doesn't know about yet stay zero (default), padding beyond them must be zero as well
+    for (int i = sizeof(config); i < payload_len; i++) {
+        if (payload[i] != 0) {
+            return RESULT_error;
+        }
+    }
+    return (stream_set_config((const struct sockaddr *)request_addr, request_addr_len, &config) == ESP_OK) ?
+           RESULT_ok : RESULT_error;
+}
+
+static int _stream_config_read(unsigned char *payload) {
+    stream_config_t config;
+    stream_get_config((const struct sockaddr *)request_addr, &config);
+    memcpy(payload, &config, sizeof(config));
+    return sizeof(config);
+}
+
+// a write of CMD_stream_start carries the stream settings to start with
+static int _stream_start_write(const unsigned char *payload, int payload_len) {
+    if (_stream_config_write(payload, payload_len) != RESULT_ok) {
+        return RESULT_error;
+    }
+    return (_stream_start_cmd(NULL) == 0) ? RESULT_ok : RESULT_error;
+}
+
+static int _save_to_eeprom_cmd(unsigned char *payload) {
+    return 0;
+}
+
+static int _loop_stats_read(unsigned char *payload) {
+    controlloop_stats_t stats;
+    controlloop_get_stats(&stats, false);
+    memcpy(payload, &stats, sizeof(stats));
+    return sizeof(stats);
+}
+
+static int _sampler_stats_read(unsigned char *payload) {
+    sampler_stats_t stats;
+    sampler_get_stats(&stats);
+    memcpy(payload, &stats, sizeof(stats));
+    return sizeof(stats);
+}
+
+static int _stream_stats_read(unsigned char *payload) {
+    stream_stats_t stats;
+    stream_get_stats(&stats);
+    memcpy(payload, &stats, sizeof(stats));
+    return sizeof(stats);
+}
+
+static int _stream_session_read(unsigned char *payload) {
+    stream_session_stats_t session;
+    stream_get_session((const struct sockaddr *)request_addr, &session);
+    memcpy(payload, &session, sizeof(session));
+    return sizeof(session);
+}
+
+static int _batch_read_cmd(unsigned char *payload);
+static int _batch_write_cmd(const unsigned char *payload, int payload_len);
+static int _dump_cmd(unsigned char *payload);
+
+
+/*
+ *  Variable registry, indexed by the id so the lookup is a single array access. Ids without an entry have no access
+ *  rights and are rejected
+ */
+#define VAR_RW (VAR_ACCESS_READ | VAR_ACCESS_WRITE)
+
+_Static_assert(sizeof(request_v2_t)+DUMP_PAYLOAD_SIZE_MAX <= REQUEST_RESPONSE_BUF_SIZE,
+               "REQUEST_RESPONSE_BUF_SIZE is too small");
+_Static_assert(VAR_ID_COUNT <= 32, "batches keep a 32-bit mask of the variables");
+
+static const var_desc_t vars[VAR_ID_COUNT] = {
+    [CMD_stream_stop] = { "CMD_stream_stop", VAR_ACCESS_READ | VAR_COMMAND, -1, 0, NULL, _stream_stop_cmd, NULL },
+    [CMD_stream_start] = { "CMD_stream_start", VAR_RW | VAR_COMMAND, -1, 0, NULL, _stream_start_cmd,
+                           _stream_start_write },
+
+    [CMD_batch] = { "CMD_batch", VAR_RW | VAR_COMMAND, -1, 0, NULL, _batch_read_cmd, _batch_write_cmd },
+    [CMD_dump] = { "CMD_dump", VAR_ACCESS_READ | VAR_COMMAND, -1, 0, NULL, _dump_cmd, NULL },
+
+    [VAR_setpoint] = { "VAR_setpoint", VAR_RW, VAR_PLAIN(params.setpoint), 1, _validate_finite, NULL, NULL },
+
+    [VAR_kP] = { "VAR_kP", VAR_RW, VAR_PLAIN(params.kP), 1, _validate_finite, NULL, NULL },
+    [VAR_kI] = { "VAR_kI", VAR_RW, VAR_PLAIN(params.kI), 1, _validate_finite, NULL, NULL },
+    [VAR_kD] = { "VAR_kD", VAR_RW, VAR_PLAIN(params.kD), 1, _validate_finite, NULL, NULL },
+
+    [VAR_err_I] = { "VAR_err_I", VAR_RW, VAR_PLAIN(err_I), 1, _validate_zero, NULL, NULL },
+
+    [VAR_err_P_limits] = { "VAR_err_P_limits", VAR_RW, VAR_PLAIN(params.err_P_limits), 2, _validate_limits, NULL,
+                           NULL },
+    [VAR_err_I_limits] = { "VAR_err_I_limits", VAR_RW, VAR_PLAIN(params.err_I_limits), 2, _validate_limits, NULL,
+                           NULL },
+
+    [VAR_gain_schedule] = { "VAR_gain_schedule", VAR_RW, -1, 0, NULL, _schedule_read, _schedule_write },
+    [VAR_cascade] = { "VAR_cascade", VAR_RW, -1, 0, NULL, _cascade_read, _cascade_write },
+
+    [VAR_stream_config] = { "VAR_stream_config", VAR_RW, -1, 0, NULL, _stream_config_read, _stream_config_write },
+
+    [CMD_save_to_eeprom] = { "CMD_save_to_eeprom", VAR_ACCESS_READ | VAR_COMMAND, -1, 0, NULL, _save_to_eeprom_cmd,
+                             NULL },
+
+    [VAR_loop_stats] = { "VAR_loop_stats", VAR_ACCESS_READ, -1, 0, NULL, _loop_stats_read, NULL },
+    [VAR_sampler_stats] = { "VAR_sampler_stats", VAR_ACCESS_READ, -1, 0, NULL, _sampler_stats_read, NULL },
+    [VAR_stream_stats] = { "VAR_stream_stats", VAR_ACCESS_READ, -1, 0, NULL, _stream_stats_read, NULL },
+    [VAR_stream_session] = { "VAR_stream_session", VAR_ACCESS_READ, -1, 0, NULL, _stream_session_read, NULL }
+};
+
+
+static void _view_load_live(vars_view_t *view) {
+
+    // a consistent snapshot of what the control loop is using right now
+    PIDdata pid;
+    controlloop_get_pid(&pid);
 
-static bool stream_run = false;
+    view->params.setpoint = PID_VALUE_TO_FLOAT(pid.setpoint);
+    view->params.kP = PID_GAIN_TO_FLOAT(pid.kP);
+    view->params.kI = PID_GAIN_TO_FLOAT(pid.kI);
+    view->params.kD = PID_GAIN_TO_FLOAT(pid.kD);
+    view->params.err_P_limits[0] = PID_VALUE_TO_FLOAT(pid.Perrmin);
+    view->params.err_P_limits[1] = PID_VALUE_TO_FLOAT(pid.Perrmax);
+    view->params.err_I_limits[0] = PID_VALUE_TO_FLOAT(pid.Ierrmin);
+    view->params.err_I_limits[1] = PID_VALUE_TO_FLOAT(pid.Ierrmax);
+    view->err_I = PID_VALUE_TO_FLOAT(pid.Ierr);
+}
+
+/*
+ *  Read a variable into the payload, returns its length. 'view' is the live view for plain variables, loaded on first
+ *  use (view_loaded) so a batch shares one snapshot
+ */
+static int _var_read(const var_desc_t *var, unsigned char *payload, vars_view_t *view, bool *view_loaded) {
+
+    if (var->read != NULL) {
+        return var->read(payload);
+    }
 
-static int points_cnt = 0;
+    if (!*view_loaded) {
+        _view_load_live(view);
+        *view_loaded = true;
+    }
+    memcpy(payload, (const unsigned char *)view + var->offset, var->count*sizeof(float));
+    return var->count*sizeof(float);
+}
+
+/*
+ *  Validate a plain variable's new value and put it into the (write) view. value_len may exceed the variable's size
+ *  only if 'padded' (legacy requests always carry 2 floats)
+ */
+static int _var_stage(int id, const unsigned char *value, int value_len, bool padded, vars_view_t *view,
+                      uint32_t *written) {
+
+    var_desc_t const *var = &vars[id];
+    int const size = var->count*sizeof(float);
+    if (!(var->access & VAR_ACCESS_WRITE) || (var->offset < 0) ||
+        (padded ? (value_len < size) : (value_len != size))) {
+        return RESULT_error;
+    }
 
-void _stream_task(void *data) {
+    float values[2];
+    memcpy(values, value, var->count*sizeof(float));
+    if ((var->validate != NULL) && (var->validate(values) != RESULT_ok)) {
+        return RESULT_error;
+    }
 
-    unsigned char stream_buf[STREAM_BUF_SIZE];
-    stream_buf[0] = STREAM_PREFIX;
+    memcpy((unsigned char *)view + var->offset, values, var->count*sizeof(float));
+    *written |= 1u << id;
+    return RESULT_ok;
+}
 
-    // double x = 0.0;
-    // double const dx = 0.1;
+/*
+ *  Publish the staged values: a complete parameter set, applied by the control loop in one step
+ */
+static int _view_publish(const vars_view_t *view, uint32_t written) {
+    bool const reset_err_I = (written & (1u << VAR_err_I)) != 0;
+    return (controlloop_set_params(&view->params, reset_err_I) == ESP_OK) ? RESULT_ok : RESULT_error;
+}
 
-    ESP_LOGI(TAG, "Stream task started");
+static int _var_write(int id, const unsigned char *payload, int payload_len, bool padded) {
 
-    while (1) {
-        if (stream_run) {
+    var_desc_t const *var = &vars[id];
+    if (var->write != NULL) {
+        return var->write(payload, payload_len);
+    }
 
-            // if (x > (2.0 * M_PI))
-            //     x = 0.0;
-            // stream_values[0] = (float)sin(x);  // Process Variable
-            // stream_values[1] = (float)cos(x);  // Controller Output
-            // x = x + dx;
+    vars_view_t view;
+    uint32_t written = 0;
+    controlloop_get_params(&view.params);
+    if (_var_stage(id, payload, payload_len, padded, &view, &written) != RESULT_ok) {
+        return RESULT_error;
+    }
+    return _view_publish(&view, written);
+}
 
-            stream_values[0] = adc1_get_raw(ADC1_CHANNEL_0);
-            stream_values[1] = adc1_get_raw(ADC1_CHANNEL_1);
 
-            memcpy(&stream_buf[1], stream_values, 2*sizeof(float));
-            
-            // datagram sockets support multiple readers/writers even simultaneously so we do not need any mutex in
-            // this simple case
-            sendto(sock, (const void *)stream_buf, STREAM_BUF_SIZE, 0, (const struct sockaddr *)&sourceAddr, socklen);
-            // if (len < 0)
-            //     error("ERROR on sendto");
+/*
+ *  Batch requests carry a list of TLV entries (see CMD_batch). Only variables can be batched, each at most once, which
+ *  also bounds the size of the response
+ */
+static unsigned char batch_request[REQUEST_RESPONSE_BUF_SIZE];
+static int batch_request_len;
 
-            points_cnt++;
+/*
+ *  Length of the TLV list without the zero padding of a legacy request: id 0 is a command, never a batch entry, so a
+ *  zero entry (at an entry boundary) followed by nothing but zeros is the end. Anything else is left to the parser
+ */
+static int _tlv_list_len(const unsigned char *tlv, int len) {
+    int i = 0;
+    while ((i + TLV_HEADER_SIZE <= len) && !((tlv[i] == 0) && (tlv[i + 1] == 0))) {
+        i += TLV_HEADER_SIZE + tlv[i + 1];
+    }
+    if (i >= len) {
+        return len;
+    }
+    for (int j = i; j < len; j++) {
+        if (tlv[j] != 0) {
+            return len;
         }
+    }
+    return i;
+}
+
+static int _batch_read_cmd(unsigned char *payload) {
+
+    vars_view_t view;
+    bool view_loaded = false;
+    uint32_t seen = 0;
+    int pos = 0;
+
+    int i = 0;
+    for (; i + TLV_HEADER_SIZE <= batch_request_len; i += TLV_HEADER_SIZE + batch_request[i + 1]) {
+        int const id = batch_request[i];
+        if ((id >= VAR_ID_COUNT) || !(vars[id].access & VAR_ACCESS_READ) || (vars[id].access & VAR_COMMAND) ||
+            (seen & (1u << id))) {
+            return -1;
+        }
+        var_desc_t const *var = &vars[id];
+        seen |= 1u << id;
+
+        int const value_len = _var_read(var, &payload[pos + TLV_HEADER_SIZE], &view, &view_loaded);
+        payload[pos] = id;
+        payload[pos + 1] = value_len;
+        pos += TLV_HEADER_SIZE + value_len;
+    }
+    // as for a write: a truncated or stray tail, or nothing to read, fails the request
+    if ((i != batch_request_len) || (seen == 0)) {
+        return -1;
+    }
+    return pos;
+}
+
+static int _batch_write_cmd(const unsigned char *payload, int payload_len) {
+
+    vars_view_t view;
+    uint32_t written = 0;
+    controlloop_get_params(&view.params);
+
+    // stage everything first, nothing is published unless the whole batch is valid
+    int i = 0;
+    while (i + TLV_HEADER_SIZE <= payload_len) {
+        int const id = payload[i];
+        int const value_len = payload[i + 1];
+        if ((id >= VAR_ID_COUNT) || (i + TLV_HEADER_SIZE + value_len > payload_len) || (written & (1u << id)) ||
+            (_var_stage(id, &payload[i + TLV_HEADER_SIZE], value_len, false, &view, &written) != RESULT_ok)) {
+            return RESULT_error;
+        }
+        i += TLV_HEADER_SIZE + value_len;
+    }
+    if ((i != payload_len) || (written == 0)) {
+        return RESULT_error;
+    }
+
+    return _view_publish(&view, written);
+}
+
+
+#define FNV1A_OFFSET_BASIS 2166136261u
+#define FNV1A_PRIME 16777619u
 
-        vTaskDelay(STREAM_THREAD_SLEEP_TIME_MS/portTICK_PERIOD_MS);
+static uint32_t _fnv1a(uint32_t hash, const void *data, size_t size) {
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * FNV1A_PRIME;
     }
+    return hash;
 }
 
+/*
+ *  Version of the configuration: FNV-1a over what has been set (the published parameters, the gain schedule and the
+ *  cascade setup), leaving out everything the loop changes by itself (integral, scheduled gains, inner setpoints)
+ */
+static uint32_t _config_hash(void) {
+
+    uint32_t hash = FNV1A_OFFSET_BASIS;
+
+    controlloop_params_t params;
+    controlloop_get_params(&params);
+    hash = _fnv1a(hash, &params, sizeof(params));
+
+    static PIDschedule schedule;
+    controlloop_get_schedule(&schedule);
+    int const points = (schedule.source != PID_SCHEDULE_OFF) ? schedule.points : 0;
+    hash = _fnv1a(hash, &schedule.source, sizeof(schedule.source));
+    hash = _fnv1a(hash, &schedule.points, sizeof(schedule.points));
+    hash = _fnv1a(hash, &schedule.x_min, sizeof(schedule.x_min));
+    hash = _fnv1a(hash, &schedule.x_max, sizeof(schedule.x_max));
+    hash = _fnv1a(hash, schedule.gains, points*sizeof(schedule.gains[0]));
+
+    static controlloop_cascade_t cascade;
+    controlloop_get_cascade(&cascade);
+    hash = _fnv1a(hash, &cascade.pid.n, sizeof(cascade.pid.n));
+    for (int i = 0; i < cascade.pid.n; i++) {
+        PIDdata const *stage = &cascade.pid.stage[i];
+        hash = _fnv1a(hash, &cascade.pv_channel[i], sizeof(cascade.pv_channel[i]));
+        hash = _fnv1a(hash, &cascade.pid.divider[i], sizeof(cascade.pid.divider[i]));
+        if (i == 0) {
+            hash = _fnv1a(hash, &stage->setpoint, sizeof(stage->setpoint));
+        }
+        hash = _fnv1a(hash, &stage->kP, 3*sizeof(stage->kP));  // kP, kI, kD
+        hash = _fnv1a(hash, &stage->Perrmin, 4*sizeof(stage->Perrmin));  // Perr and Ierr limits
+    }
 
-void stream_start(void) {
-    if (!stream_run)
-        stream_run = true;
+    return hash;
 }
 
-void stream_stop(void) {
-    if (stream_run) {
-        stream_run = false;
+static int _dump_cmd(unsigned char *payload) {
+
+    uint32_t const hash = _config_hash();
+    memcpy(payload, &hash, sizeof(hash));
+
+    vars_view_t view;
+    bool view_loaded = false;
+    int pos = sizeof(hash);
 
-        ESP_LOGI(TAG, "points: %d", points_cnt);
-        points_cnt = 0;
+    for (int id = 0; id < VAR_ID_COUNT; id++) {
+        var_desc_t const *var = &vars[id];
+        if (!(var->access & VAR_ACCESS_READ) || (var->access & VAR_COMMAND)) {
+            continue;
+        }
+        int const value_len = _var_read(var, &payload[pos + TLV_HEADER_SIZE], &view, &view_loaded);
+        payload[pos] = id;
+        payload[pos + 1] = value_len;
+        pos += TLV_HEADER_SIZE + value_len;
     }
+    return pos;
 }
 
 
 /*
- *  Sample values, not constants so client can both read/write them
+ *  Common part of both protocol versions: look the id up and read/write in place. Returns the result, a read also sets
+ *  the length of the value put into the payload
  */
-static float setpoint = 1238.0f;
-static float kP = 19.4f;
-static float kI = 8.7f;
-static float kD = 1.6f;
-static float err_I = 2055.0f;
-static float err_P_limits[2] = {-3500.0f, 3500.0f};
-static float err_I_limits[2] = {-6500.0f, 6500.0f};
+static int _dispatch(bool write, unsigned id, unsigned char *payload, int payload_len, bool padded,
+                     int *response_payload_len) {
+
+    *response_payload_len = 0;
 
+    if ((id >= VAR_ID_COUNT) || !(vars[id].access & (write ? VAR_ACCESS_WRITE : VAR_ACCESS_READ))) {
+        BINLOG_W(BINLOG_EV_REQUEST_REJECTED, write, id);
+        return RESULT_error;
+    }
+    var_desc_t const *var = &vars[id];
 
-static const char *tag_read = "read";
-static const char *tag_write = "write";
+    if ((id == CMD_batch) && padded) {
+        payload_len = _tlv_list_len(payload, payload_len);
+    }
+    else if ((id == VAR_cascade) && padded && (payload_len == (int)(2*sizeof(float)))) {
+        // a legacy write returning to the single loop: the zero stage count and its zero padding
+        static const unsigned char no_stages[2*sizeof(float)] = { 0 };
+        if (!memcmp(payload, no_stages, sizeof(no_stages))) {
+            payload_len = sizeof(uint8_t);
+        }
+    }
+    if (write) {
+        int const result = _var_write(id, payload, payload_len, padded);
+        BINLOG_I(BINLOG_EV_REQUEST, write, id, result);
+        return result;
+    }
 
-int process_request(unsigned char *request_response_buf) {
-// int process_request(unsigned char *request_buf, unsigned char *response_buf) {
+    if (id == CMD_batch) {
+        // the response is built in the same buffer, keep the list of requested entries aside
+        batch_request_len = payload_len;
+        memcpy(batch_request, payload, payload_len);
+    }
+    vars_view_t view;
+    bool view_loaded = false;
+    int const value_len = _var_read(var, payload, &view, &view_loaded);
+    int const result = (value_len >= 0) ? RESULT_ok : RESULT_error;
+    BINLOG_I(BINLOG_EV_REQUEST, write, id, result);
+    if (result == RESULT_ok) {
+        *response_payload_len = value_len;
+    }
+    return result;
+}
 
-    int result = 0;
+
+/*
+ *  Legacy request: 1-byte header, the payload padded to (at least) 2 floats both ways
+ */
+static int _process_legacy(unsigned char *request_response_buf, int *len) {
 
     /*
      *  Currently we use the same one buffer for both parsing the request and constructing the response. As
@@ -115,139 +579,68 @@ int process_request(unsigned char *request_response_buf) {
      *  Such approach looks more messy but, guess, should be faster to execute in hardware
      */
     response_t request;
-    // request_t request;
     memcpy(&request, &request_response_buf[0], sizeof(char));
 
-    // response_t response;
-    // memcpy(&response, request_buf, sizeof(char));
-
-    // float values[2];
-    // memset(values, 0, 2*sizeof(float));
-
-    // printf("OPCODE: 0x%X\n", opcode);
-    // printf("VAR CMD: 0x%X\n", var_cmd);
-
-    if (request.opcode == OPCODE_read) {
-        // 'read' request from the client - we do not need cells allocated for values (doesn't care whether they were
-        // supplied or not). Instead, we will use them to return values
-        memset(&request_response_buf[1], 0, 2*sizeof(float));
-        
-        switch (request.var_cmd) {
-            case CMD_stream_stop:
-                ESP_LOGI(tag_read, "CMD_stream_stop");
-                stream_stop();
-                result = RESULT_ok;
-                break;
-            case CMD_stream_start:
-                ESP_LOGI(tag_read, "CMD_stream_start");
-                stream_start();
-                result = RESULT_ok;
-                break;
-
-            case VAR_setpoint:
-                ESP_LOGI(tag_read, "VAR_setpoint");
-                memcpy(&request_response_buf[1], &(p_pid_data->setpoint), sizeof(float));
-                result = RESULT_ok;
-                break;
-            case VAR_kP:
-                ESP_LOGI(tag_read, "VAR_kP");
-                memcpy(&request_response_buf[1], &kP, sizeof(float));
-                result = RESULT_ok;
-                break;
-            case VAR_kI:
-                ESP_LOGI(tag_read, "VAR_kI");
-                memcpy(&request_response_buf[1], &kI, sizeof(float));
-                result = RESULT_ok;
-                break;
-            case VAR_kD:
-                ESP_LOGI(tag_read, "VAR_kD");
-                memcpy(&request_response_buf[1], &kD, sizeof(float));
-                result = RESULT_ok;
-                break;
-            case VAR_err_I:
-                ESP_LOGI(tag_read, "VAR_err_I");
-                memcpy(&request_response_buf[1], &err_I, sizeof(float));
-                result = RESULT_ok;
-                break;
-            case VAR_err_P_limits:
-                ESP_LOGI(tag_read, "VAR_err_P_limits");
-                memcpy(&request_response_buf[1], err_P_limits, 2*sizeof(float));
-                result = RESULT_ok;
-                break;
-            case VAR_err_I_limits:
-                ESP_LOGI(tag_read, "VAR_err_I_limits");
-                memcpy(&request_response_buf[1], err_I_limits, 2*sizeof(float));
-                result = RESULT_ok;
-                break;
-
-            case CMD_save_to_eeprom:
-                ESP_LOGI(tag_read, "CMD_save_to_eeprom");
-                result = RESULT_ok;
-                break;
-
-            default:
-                ESP_LOGI(tag_read, "Unknown or incorrect request");
-                result = RESULT_error;
-                break;
-        }
+    int const payload_len = (*len > (int)sizeof(char)) ? *len - (int)sizeof(char) : 0;
+    int value_len;
+    int const result = _dispatch(request.opcode == OPCODE_write, request.var_cmd, &request_response_buf[1],
+                                 payload_len, true, &value_len);
+
+    // writes and failed requests answer with zeroed values, short values are zero-padded
+    if (result != RESULT_ok) {
+        value_len = 0;
     }
-    
-    else {        
-        switch (request.var_cmd) {
-            case VAR_setpoint:
-                ESP_LOGI(tag_write, "VAR_setpoint");
-                memcpy(&setpoint, &request_response_buf[1], sizeof(float));
-                result = RESULT_ok;
-                break;
-            case VAR_kP:
-                ESP_LOGI(tag_write, "VAR_kP");
-                memcpy(&kP, &request_response_buf[1], sizeof(float));
-                result = RESULT_ok;
-                break;
-            case VAR_kI:
-                ESP_LOGI(tag_write, "VAR_kI");
-                memcpy(&kI, &request_response_buf[1], sizeof(float));
-                result = RESULT_ok;
-                break;
-            case VAR_kD:
-                ESP_LOGI(tag_write, "VAR_kD");
-                memcpy(&kD, &request_response_buf[1], sizeof(float));
-                result = RESULT_ok;
-                break;
-            case VAR_err_I:
-                ESP_LOGI(tag_write, "VAR_err_I");
-                if (*(float *)&request_response_buf[1] == 0.0f) {
-                    err_I = 0.0f;
-                    result = RESULT_ok;
-                }
-                else {
-                    result = RESULT_error;
-                }
-                break;
-            case VAR_err_P_limits:
-                ESP_LOGI(tag_write, "VAR_err_P_limits");
-                memcpy(err_P_limits, &request_response_buf[1], 2*sizeof(float));
-                result = RESULT_ok;
-                break;
-            case VAR_err_I_limits:
-                ESP_LOGI(tag_write, "VAR_err_I_limits");
-                memcpy(err_I_limits, &request_response_buf[1], 2*sizeof(float));
-                result = RESULT_ok;
-                break;
-
-            default:
-                ESP_LOGI(tag_write, "Unknown or incorrect request");
-                result = RESULT_error;
-                break;
-        }
-        
-        memset(&request_response_buf[1], 0, 2*sizeof(float));
+    if (value_len < (int)(2*sizeof(float))) {
+        memset(&request_response_buf[1 + value_len], 0, 2*sizeof(float) - value_len);
     }
 
     request.result = result;
     memcpy(request_response_buf, &request, sizeof(char));
-    //    response.result = result;
-    //    memcpy(response_buf, &response, sizeof(char));
 
+    *len = (value_len > (int)(2*sizeof(float))) ? (int)sizeof(char) + value_len : (int)REQUEST_RESPONSE_SIZE;
     return result;
 }
+
+
+static int _process_v2(unsigned char *request_response_buf, int *len) {
+
+    request_v2_t header;
+    memcpy(&header, request_response_buf, sizeof(header));
+
+    int result;
+    int value_len = 0;
+    int const payload_len = *len - (int)sizeof(header);
+    if ((payload_len < 0) || (header.len != payload_len) || (header.loop != 0)) {
+        BINLOG_W(BINLOG_EV_REQUEST_MALFORMED, *len, header.len, header.loop);
+        result = RESULT_error;
+    }
+    else {
+        result = _dispatch(header.flags & V2_FLAG_WRITE, header.id, &request_response_buf[sizeof(header)],
+                           payload_len, false, &value_len);
+        if (result != RESULT_ok) {
+            value_len = 0;
+        }
+    }
+
+    header.flags = (header.flags & V2_FLAG_WRITE) | ((result != RESULT_ok) ? V2_FLAG_ERROR : 0);
+    header.len = value_len;
+    memcpy(request_response_buf, &header, sizeof(header));
+
+    *len = sizeof(header) + value_len;
+    return result;
+}
+
+
+/*
+ *  Process the request of *len bytes in place, *len is then set to the length of the response. Both protocol
+ *  versions are served, told apart by the first byte
+ */
+int process_request(unsigned char *request_response_buf, int *len, const struct sockaddr *client_addr,
+                    socklen_t client_addr_len) {
+    request_addr = client_addr;
+    request_addr_len = client_addr_len;
+    if ((*len >= 1) && (request_response_buf[0] == PROTOCOL_V2_MAGIC)) {
+        return _process_v2(request_response_buf, len);
+    }
+    return _process_legacy(request_response_buf, len);
+}
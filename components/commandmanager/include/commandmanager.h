@@ -13,6 +13,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>  // for memset()
+#include <stddef.h>  // for offsetof()
+#include <sys/param.h>  // for MIN()
 #include <stdbool.h>
 #include <math.h>
 
@@ -24,8 +26,13 @@
 #include "lwip/sockets.h"
 
 #include "esp_log.h"
+#include "esp_timer.h"
+
+#include "binlog.h"
 
 #include "pid.h"
+#include "controlloop.h"
+#include "stream.h"
 
 // #include "sodium.h"
 
@@ -33,11 +40,6 @@
 extern const char *TAG;
 
 
-extern int sock;
-extern struct sockaddr_in6 sourceAddr;  // client address
-extern socklen_t socklen;  // byte size of client's address
-
-
 enum {
     OPCODE_read,
     OPCODE_write
@@ -55,11 +57,25 @@ enum {
     VAR_err_P_limits = 0b1001,
     VAR_err_I_limits = 0b1010,
 
+    VAR_gain_schedule = 0b1100,  // variable length, see below
+    VAR_cascade = 0b1101,  // variable length, see below
+
+    VAR_stream_config = 0b1110,  // stream_config_t, see stream.h
+
     // special
-    CMD_stream_start = 0b0001,
+    CMD_stream_start = 0b0001,  // a write carries the stream_config_t to start with
     CMD_stream_stop = 0b0000,
 
-    CMD_save_to_eeprom = 0b1011
+    CMD_batch = 0b0010,  // variable length, see below
+    CMD_dump = 0b0011,  // variable length, see below
+
+    CMD_save_to_eeprom = 0b1011,
+
+    // protocol v2 only (beyond the 4-bit id of the legacy header)
+    VAR_loop_stats = 0x0010,  // controlloop_stats_t, read-only
+    VAR_sampler_stats = 0x0011,  // sampler_stats_t, read-only
+    VAR_stream_stats = 0x0012,  // stream_stats_t, read-only
+    VAR_stream_session = 0x0013  // stream_session_stats_t of the requesting client, read-only
 };
 
 enum {
@@ -67,7 +83,65 @@ enum {
     RESULT_error
 };
 
-#define STREAM_PREFIX 0b00000001
+
+#define REQUEST_RESPONSE_SIZE (sizeof(char)+2*sizeof(float))  // regular requests and responses
+
+/*
+ *  VAR_gain_schedule payload (both the write request and the read response), after the header byte: source (uint8_t,
+ *  PID_SCHEDULE_OFF/_BY_SETPOINT/_BY_PV), points (uint8_t), x_min, x_max (floats), then kP, kI, kD (floats) for each
+ *  point. A write with PID_SCHEDULE_OFF may omit everything after the source
+ */
+#define SCHEDULE_PAYLOAD_HEADER_SIZE (2*sizeof(uint8_t)+2*sizeof(float))
+#define SCHEDULE_PAYLOAD_SIZE_MAX (SCHEDULE_PAYLOAD_HEADER_SIZE+PID_SCHEDULE_POINTS_MAX*3*sizeof(float))
+
+/*
+ *  VAR_cascade payload (both the write request and the read response), after the header byte: number of stages
+ *  (uint8_t, 0 returns to the single loop), then for every stage from the outermost one: process variable ADC1
+ *  channel (uint8_t), rate divider (uint16_t), setpoint, kP, kI, kD, Perr min, Perr max, Ierr min, Ierr max (floats).
+ *  The setpoints of the inner stages are ignored on write, a read returns the live ones. A write has to be exactly as
+ *  long as its stages (a single byte for none; legacy requests may zero-pad it)
+ */
+#define CASCADE_STAGE_PAYLOAD_SIZE (sizeof(uint8_t)+sizeof(uint16_t)+8*sizeof(float))
+#define CASCADE_PAYLOAD_SIZE_MAX (sizeof(uint8_t)+PID_CASCADE_STAGES_MAX*CASCADE_STAGE_PAYLOAD_SIZE)
+
+/*
+ *  CMD_batch: the payload is a list of TLV entries, each one being the variable id (uint8_t), the value length
+ *  (uint8_t) and the value. A read request lists entries with no value and the response returns them filled in; a
+ *  write request carries the values of plain variables (single-float and limits ones, including err_I) which are
+ *  validated all together and applied by the control loop in one step, or not at all. Every variable may appear at
+ *  most once. The zero padding of a legacy request after the last entry is ignored. CMD_dump (read) responds with a
+ *  32-bit configuration version (FNV-1a of everything set by the clients) followed by the TLV entries of all readable
+ *  variables
+ */
+#define TLV_HEADER_SIZE (2*sizeof(uint8_t))
+#define DUMP_PAYLOAD_SIZE_MAX (sizeof(uint32_t)+VAR_ID_COUNT*(TLV_HEADER_SIZE+2*sizeof(float))+ \
+                               SCHEDULE_PAYLOAD_SIZE_MAX+CASCADE_PAYLOAD_SIZE_MAX+ \
+                               sizeof(controlloop_stats_t)+sizeof(sampler_stats_t)+sizeof(stream_config_t)+ \
+                               sizeof(stream_stats_t)+sizeof(stream_session_stats_t))
+
+#define REQUEST_RESPONSE_BUF_SIZE 704
+
+
+#define VAR_ID_COUNT 0x14  // registry size, ids 0..15 are reachable through the legacy header as well
+
+#define VAR_ACCESS_READ (1 << 0)
+#define VAR_ACCESS_WRITE (1 << 1)
+#define VAR_COMMAND (1 << 2)  // not a variable: never part of a batch or a dump
+
+/*
+ *  Variable (or command) descriptor. Plain variables are 'count' floats at 'offset' in the parameter view and are
+ *  read/written by the common code after the optional validation; anything else (commands, variable-length payloads,
+ *  special semantics) supplies its own read/write hook, which then takes precedence
+ */
+typedef struct var_desc {
+    const char *name;
+    uint8_t access;
+    int16_t offset;
+    uint8_t count;
+    int (*validate)(const float *values);
+    int (*read)(unsigned char *payload);  // fills the response payload, returns its length
+    int (*write)(const unsigned char *payload, int payload_len);  // returns RESULT_ok/RESULT_error
+} var_desc_t;
 
 
 typedef struct request {
@@ -84,15 +158,34 @@ typedef struct response {
 } response_t;
 
 
+/*
+ *  Protocol v2 header, used by both requests and responses on the same port. The magic byte has non-zero low 3 bits,
+ *  which are reserved (always zero) in the legacy header, so the two never get confused. The payload is exactly 'len'
+ *  bytes (no padding to 2 floats); the response echoes id, seq and loop, sets V2_FLAG_ERROR on failure and carries
+ *  the read value (nothing for writes). Multi-byte fields are little-endian
+ */
+#define PROTOCOL_V2_MAGIC 0x5A
+
+#define V2_FLAG_WRITE (1 << 0)  // opcode
+#define V2_FLAG_ERROR (1 << 1)  // result
+
+typedef struct request_v2 {
+    uint8_t magic;
+    uint8_t flags;
+    uint16_t id;
+    uint16_t len;  // payload length
+    uint16_t seq;  // chosen by the client to match responses, echoed back
+    uint8_t loop;  // loop/channel index, 0 is the control loop (the only one addressable so far)
+    uint8_t _reserved;
+} __attribute__((packed)) request_v2_t;
+
+
 // void _print_bin_hex(unsigned char byte);
 
 void error(char *msg);
 
-void _stream_task(void *data);
-void stream_start(void);
-void stream_stop(void);
-
-int process_request(unsigned char *request_response_buf);
+int process_request(unsigned char *request_response_buf, int *len, const struct sockaddr *client_addr,
+                    socklen_t client_addr_len);
 // int process_request(unsigned char *request_buf, unsigned char *response_buf);
 
 
@@ -0,0 +1,4 @@
+#
+# "controlloop" component makefile.
+#
+# (Uses default behaviour of compiling all source files in directory, adding 'include' to include path.)
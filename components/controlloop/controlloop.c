@@ -0,0 +1,684 @@
+//
+//  controlloop.c
+//  pid-controller-server
+//
+//  Fixed-rate control loop: samples the process variable, runs PID_Update() and drives the controller output. The
+//  step runs either in a dedicated FreeRTOS task (tick resolution) or from a high-resolution esp_timer callback. Gains
+//  may be scheduled on the setpoint or the process variable from an uploaded table, or the single loop may be replaced
+//  with a cascade of controllers
+//
+
+#include "controlloop.h"
+
+
+#define CONTROL_TASK_PRIORITY 10  // above udp_server_task
+#define CONTROL_TASK_STACK_SIZE 4096
+
+#if CONFIG_CONTROL_LOOP_MODE_TASK
+#if CONFIG_CONTROL_LOOP_RATE_HZ > CONFIG_FREERTOS_HZ
+#error "Control loop rate cannot exceed the FreeRTOS tick rate (CONFIG_FREERTOS_HZ) in the task mode"
+#endif
+#define CONTROL_PERIOD_TICKS (CONFIG_FREERTOS_HZ / CONFIG_CONTROL_LOOP_RATE_HZ)
+#define CONTROL_PERIOD_US (CONTROL_PERIOD_TICKS * (1000000 / CONFIG_FREERTOS_HZ))
+#else
+#define CONTROL_PERIOD_US (1000000 / CONFIG_CONTROL_LOOP_RATE_HZ)
+#endif
+
+#define CONTROL_OUT_FULL_SCALE 4095.0f  // controller output is expressed in the same units as 12-bit ADC readings
+#define CONTROL_DAC_FULL_SCALE 255.0f
+
+
+static const char *tag_control = "control";
+
+
+/*
+ *  Values of the last step. Each one is a single 32-bit word so readers never get a torn value, though the pair may
+ *  come from adjacent steps
+ */
+static volatile float process_variable = 0.0f;
+static volatile float controller_output = 0.0f;
+
+static controlloop_totals_t totals;
+static uint32_t totals_seq = 0;  // odd while the step updates the totals
+
+#if (CONFIG_CONTROL_LOOP_RING_LEN & (CONFIG_CONTROL_LOOP_RING_LEN - 1)) != 0
+#error "CONFIG_CONTROL_LOOP_RING_LEN must be a power of 2"
+#endif
+#define RING_MASK (CONFIG_CONTROL_LOOP_RING_LEN - 1)
+
+/*
+ *  The step stores the number of the step into ring_seq[] before the values, so a reader finding it unchanged after
+ *  the use knows the values were not touched (the slots are overwritten in order, so checking the oldest one of a run
+ *  covers the whole run)
+ */
+static controlloop_point_t ring[CONFIG_CONTROL_LOOP_RING_LEN];
+static uint32_t ring_timestamp[CONFIG_CONTROL_LOOP_RING_LEN];  // kept apart so the slots stay stream points
+static controlloop_terms_t ring_terms[CONFIG_CONTROL_LOOP_RING_LEN];
+static uint32_t ring_seq[CONFIG_CONTROL_LOOP_RING_LEN];
+static uint32_t ring_head = 0;  // number of the next step
+
+/*
+ *  Statistics are only written by the control step. Readers ask for a reset through the flag so the window is
+ *  restarted at a step boundary
+ */
+static controlloop_stats_t stats;
+static volatile bool stats_reset_req = true;
+static int64_t step_prev_us = 0;
+static float period_sum_us = 0.0f;
+static float jitter_sq_sum_us2 = 0.0f;
+
+
+static inline void IRAM_ATTR _stats_update(int64_t step_start_us) {
+
+    if (stats_reset_req) {
+        memset(&stats, 0, sizeof(stats));
+        stats.period_nominal_us = CONTROL_PERIOD_US;
+        stats.period_min_us = INT32_MAX;
+        period_sum_us = 0.0f;
+        jitter_sq_sum_us2 = 0.0f;
+        step_prev_us = 0;
+        stats_reset_req = false;
+    }
+
+    if (step_prev_us != 0) {
+        int32_t const period_us = (int32_t)(step_start_us - step_prev_us);
+        if (period_us < stats.period_min_us) {
+            stats.period_min_us = period_us;
+        }
+        if (period_us > stats.period_max_us) {
+            stats.period_max_us = period_us;
+        }
+        period_sum_us += period_us;
+
+        // jitter: deviation of the achieved period from the nominal one
+        int32_t const jitter_us = (period_us > CONTROL_PERIOD_US) ? (period_us - CONTROL_PERIOD_US)
+                                                                  : (CONTROL_PERIOD_US - period_us);
+        if (jitter_us > stats.jitter_max_us) {
+            stats.jitter_max_us = jitter_us;
+        }
+        jitter_sq_sum_us2 += (float)jitter_us * (float)jitter_us;
+
+        // stats.iterations is the number of measured periods here as the first step of a window isn't counted yet
+        stats.period_avg_us = period_sum_us / stats.iterations;
+    }
+    step_prev_us = step_start_us;
+}
+
+
+/*
+ *  Double-buffered configuration blocks (gain schedule, cascade): the writer fills the slot the step is not using and
+ *  publishes it by bumping seq, the step picks the slot by seq and reports the sequence it has finished with in seen.
+ *  A slot is only refilled once the step has moved away from it, so neither side ever waits for the other inside a
+ *  step. Writers must not race each other
+ */
+typedef struct swap_state {
+    uint32_t seq;
+    uint32_t seen;
+} swap_state_t;
+
+// the step takes a slot up within one period, so two periods and a margin only run out with the loop stopped
+#define SWAP_TIMEOUT_MS (2 * 1000 / CONFIG_CONTROL_LOOP_RATE_HZ + 100)
+
+static inline uint32_t IRAM_ATTR _swap_acquire(swap_state_t *swap) {
+    return __atomic_load_n(&swap->seq, __ATOMIC_ACQUIRE);
+}
+
+static inline void IRAM_ATTR _swap_release(swap_state_t *swap, uint32_t seq) {
+    __atomic_store_n(&swap->seen, seq, __ATOMIC_RELEASE);
+}
+
+/*
+ *  Index of the slot the writer may fill. A write following the previous one within a control period waits for the
+ *  step to take that one up (up to a period, which at low rates holds the caller up for as long). Fails with
+ *  ESP_ERR_TIMEOUT once SWAP_TIMEOUT_MS have passed, i.e. the loop is not running
+ */
+static esp_err_t _swap_wait_free(swap_state_t *swap, int *slot_idx) {
+    uint32_t const seq = __atomic_load_n(&swap->seq, __ATOMIC_RELAXED);
+    for (TickType_t waited = 0; __atomic_load_n(&swap->seen, __ATOMIC_ACQUIRE) != seq; waited++) {
+        if (waited >= pdMS_TO_TICKS(SWAP_TIMEOUT_MS)) {
+            return ESP_ERR_TIMEOUT;
+        }
+        vTaskDelay(1);
+    }
+    *slot_idx = (seq + 1) & 1;
+    return ESP_OK;
+}
+
+static void _swap_publish(swap_state_t *swap) {
+    __atomic_store_n(&swap->seq, swap->seq + 1, __ATOMIC_RELEASE);
+}
+
+
+static PIDschedule schedule_slots[2];
+static swap_state_t schedule_swap;
+
+static controlloop_cascade_t cascade_slots[2];
+static swap_state_t cascade_swap;
+
+/*
+ *  Parameters of the single loop: complete sets (optionally with an integral reset) are published through the swap and
+ *  applied to pid_data together at the start of a step. pid_data itself is only written by the step, which brackets
+ *  its changes with live_seq (odd while writing) so controlloop_get_pid() can take a consistent snapshot without ever
+ *  holding the step up
+ */
+typedef struct params_slot {
+    controlloop_params_t params;
+    bool reset_err_I;
+} params_slot_t;
+
+static params_slot_t params_slots[2];
+static swap_state_t params_swap;
+static uint32_t live_seq = 0;
+
+
+/*
+ *  Newest averaged reading from the sampler's buffers, no driver call on the hot path. The previous value is kept
+ *  until the first frame arrives
+ */
+static inline float IRAM_ATTR _sample_input(void) {
+    static float input = 0.0f;
+    sampler_get_value(CONTROL_LOOP_PV_CHANNEL, &input, NULL);
+    return input;
+}
+
+/*
+ *  Drive the DAC. Returns the output as applied: clamped to the actuator range (a NaN becomes zero)
+ */
+static inline float IRAM_ATTR _write_output(float output) {
+    if (!(output > 0.0f)) {
+        output = 0.0f;
+    }
+    else if (output > CONTROL_OUT_FULL_SCALE) {
+        output = CONTROL_OUT_FULL_SCALE;
+    }
+    dac_output_voltage(CONTROL_LOOP_OUT_CHANNEL, (uint8_t)(output * (CONTROL_DAC_FULL_SCALE/CONTROL_OUT_FULL_SCALE)));
+    return output;
+}
+
+
+static inline void IRAM_ATTR _pid_terms(const PIDdata *pid, controlloop_terms_t *terms) {
+    terms->setpoint = PID_VALUE_TO_FLOAT(pid->setpoint);
+    terms->err_P = PID_VALUE_TO_FLOAT(pid->Perr);
+    terms->err_I = PID_VALUE_TO_FLOAT(pid->Ierr);
+    terms->err_D = PID_VALUE_TO_FLOAT(pid->Derr);
+}
+
+
+#if CONFIG_CONTROL_LOOP_ENGINE_VELOCITY
+
+static PIDvelocity pid_velocity;
+
+/*
+ *  The velocity-form controller takes the gains and the setpoint of pid_data, which stays the single source of the
+ *  parameters. dt=1 keeps the per-step gain units of PID_Update(); the output limits are the actuator range, which
+ *  also makes the anti-windup
+ */
+static inline void IRAM_ATTR _engine_sync(void) {
+    PID_VelocityCoefficients(&pid_velocity, PID_VALUE_TO_FLOAT(p_pid_data->setpoint), PID_GAIN_TO_FLOAT(p_pid_data->kP),
+                             PID_GAIN_TO_FLOAT(p_pid_data->kI), PID_GAIN_TO_FLOAT(p_pid_data->kD));
+}
+
+static void _engine_init(void) {
+    PID_VelocityInit(&pid_velocity, 1.0f);
+    PID_VelocitySetLimits(&pid_velocity, 0.0f, CONTROL_OUT_FULL_SCALE);
+    _engine_sync();
+}
+
+static inline float IRAM_ATTR _engine_update(float input) {
+    return PID_VelocityUpdate(&pid_velocity, input);
+}
+
+static inline void IRAM_ATTR _engine_terms(controlloop_terms_t *terms) {
+    terms->setpoint = pid_velocity.setpoint;
+    terms->err_P = pid_velocity.e1;
+    terms->err_I = NAN;
+    terms->err_D = pid_velocity.e1 - pid_velocity.e2;
+}
+
+#else
+
+static inline void IRAM_ATTR _engine_sync(void) {}
+
+static void _engine_init(void) {}
+
+static inline float IRAM_ATTR _engine_update(float input) {
+    return PID_VALUE_TO_FLOAT(PID_Update(p_pid_data, PID_VALUE_FROM_FLOAT(input)));
+}
+
+static inline void IRAM_ATTR _engine_terms(controlloop_terms_t *terms) {
+    _pid_terms(p_pid_data, terms);
+}
+
+#endif
+
+
+/*
+ *  Take over a newly published parameter set. Returns true if pid_data has changed
+ */
+static inline bool IRAM_ATTR _params_apply(void) {
+    static uint32_t applied_seq = 0;
+    bool changed = false;
+
+    uint32_t const seq = _swap_acquire(&params_swap);
+    if (seq != applied_seq) {
+        params_slot_t const *slot = &params_slots[seq & 1];
+        PID_Coefficients(p_pid_data, slot->params.setpoint, slot->params.kP, slot->params.kI, slot->params.kD);
+        PID_SetLimitsPerr(p_pid_data, slot->params.err_P_limits[0], slot->params.err_P_limits[1]);
+        PID_SetLimitsIerr(p_pid_data, slot->params.err_I_limits[0], slot->params.err_I_limits[1]);
+        if (slot->reset_err_I) {
+            PID_ResetIerr(p_pid_data);
+        }
+        applied_seq = seq;
+        changed = true;
+    }
+    _swap_release(&params_swap, seq);
+
+    return changed;
+}
+
+/*
+ *  Gains from the schedule, if there is one. Returns true if pid_data has changed
+ */
+static inline bool IRAM_ATTR _schedule_gains(float input) {
+    bool changed = false;
+
+    uint32_t const seq = _swap_acquire(&schedule_swap);
+    PIDschedule const *schedule = &schedule_slots[seq & 1];
+    if (schedule->source != PID_SCHEDULE_OFF) {
+        float kP, kI, kD;
+        float const x = (schedule->source == PID_SCHEDULE_BY_PV) ? input : PID_VALUE_TO_FLOAT(p_pid_data->setpoint);
+        PID_ScheduleLookup(schedule, x, &kP, &kI, &kD);
+        p_pid_data->kP = PID_GAIN_FROM_FLOAT(kP);
+        p_pid_data->kI = PID_GAIN_FROM_FLOAT(kI);
+        p_pid_data->kD = PID_GAIN_FROM_FLOAT(kD);
+        changed = true;
+    }
+    _swap_release(&schedule_swap, seq);
+    return changed;
+}
+
+/*
+ *  The single loop on pid_data
+ */
+static inline float IRAM_ATTR _single_update(float input) {
+
+    __atomic_store_n(&live_seq, live_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    bool const params_changed = _params_apply();
+    if (_schedule_gains(input) || params_changed) {
+        _engine_sync();
+    }
+    float const output = _engine_update(input);
+
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&live_seq, live_seq + 1, __ATOMIC_RELAXED);
+
+    return output;
+}
+
+/*
+ *  The single loop while a cascade runs instead: parameters published meanwhile are still taken over and a new gain
+ *  schedule is acknowledged (it is looked up once the loop resumes), so writers never wait for the step
+ */
+static inline void IRAM_ATTR _single_idle(void) {
+
+    __atomic_store_n(&live_seq, live_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    if (_params_apply()) {
+        _engine_sync();
+    }
+
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&live_seq, live_seq + 1, __ATOMIC_RELAXED);
+
+    _swap_release(&schedule_swap, _swap_acquire(&schedule_swap));
+}
+
+
+/*
+ *  Cascade tick: every stage reads its own process variable, the innermost one is reported as the loop's one
+ */
+static inline float IRAM_ATTR _cascade_update(controlloop_cascade_t *cascade, float *input) {
+    static float inputs[PID_CASCADE_STAGES_MAX];  // the previous values are kept until the first frame arrives
+    pid_value_t inputs_engine[PID_CASCADE_STAGES_MAX];
+
+    for (int i = 0; i < cascade->pid.n; i++) {
+        sampler_get_value(cascade->pv_channel[i], &inputs[i], NULL);
+        inputs_engine[i] = PID_VALUE_FROM_FLOAT(inputs[i]);
+    }
+    *input = inputs[cascade->pid.n - 1];
+    return PID_VALUE_TO_FLOAT(PID_CascadeUpdate(&cascade->pid, inputs_engine));
+}
+
+
+/*
+ *  The published parameter set starts as what pid_data has been initialized with
+ */
+static void _params_init(void) {
+    controlloop_params_t *params = &params_slots[_swap_acquire(&params_swap) & 1].params;
+    params->setpoint = PID_VALUE_TO_FLOAT(p_pid_data->setpoint);
+    params->kP = PID_GAIN_TO_FLOAT(p_pid_data->kP);
+    params->kI = PID_GAIN_TO_FLOAT(p_pid_data->kI);
+    params->kD = PID_GAIN_TO_FLOAT(p_pid_data->kD);
+    params->err_P_limits[0] = PID_VALUE_TO_FLOAT(p_pid_data->Perrmin);
+    params->err_P_limits[1] = PID_VALUE_TO_FLOAT(p_pid_data->Perrmax);
+    params->err_I_limits[0] = PID_VALUE_TO_FLOAT(p_pid_data->Ierrmin);
+    params->err_I_limits[1] = PID_VALUE_TO_FLOAT(p_pid_data->Ierrmax);
+}
+
+
+/*
+ *  A value in the units of the totals, saturated to the int32_t range the sums are made of (a NaN counts as zero)
+ */
+static inline int32_t IRAM_ATTR _totals_value(float value) {
+    float const scaled = value * CONTROLLOOP_TOTALS_SCALE;
+    if (scaled >= 2147483648.0f) {
+        return INT32_MAX;
+    }
+    if (scaled <= -2147483648.0f) {
+        return INT32_MIN;
+    }
+    return (scaled == scaled) ? (int32_t)scaled : 0;
+}
+
+
+/*
+ *  One control step, common for both modes. Placed in IRAM (as well as PID_Update()) so its timing doesn't depend on
+ *  the flash cache, which is busy during Wi-Fi activity
+ */
+static void IRAM_ATTR _control_step(void) {
+
+    int64_t const step_start_us = esp_timer_get_time();
+    _stats_update(step_start_us);
+
+    float input;
+    float output;
+    controlloop_terms_t terms;
+
+    uint32_t const cascade_seq = _swap_acquire(&cascade_swap);
+    controlloop_cascade_t *cascade = &cascade_slots[cascade_seq & 1];
+    if (cascade->pid.n > 0) {
+        _single_idle();
+        output = _cascade_update(cascade, &input);
+        _pid_terms(&cascade->pid.stage[cascade->pid.n - 1], &terms);
+    }
+    else {
+        input = _sample_input();
+        output = _single_update(input);
+        _engine_terms(&terms);
+    }
+    _swap_release(&cascade_swap, cascade_seq);
+
+    output = _write_output(output);  // what is reported from here on is the output actually applied
+
+    process_variable = input;
+    controller_output = output;
+    stats.iterations++;
+
+    // scaled to integers (a single hardware conversion each) so the sums never lose resolution as they grow
+    __atomic_store_n(&totals_seq, totals_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    totals.steps++;
+    totals.pv_sum += _totals_value(input);
+    totals.out_sum += _totals_value(output);
+    totals.timestamp_us = step_start_us;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&totals_seq, totals_seq + 1, __ATOMIC_RELAXED);
+
+    uint32_t const slot = ring_head & RING_MASK;
+    __atomic_store_n(&ring_seq[slot], ring_head, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    ring[slot].process_variable = input;
+    ring[slot].controller_output = output;
+    ring_timestamp[slot] = (uint32_t)step_start_us;
+    ring_terms[slot] = terms;
+    __atomic_store_n(&ring_head, ring_head + 1, __ATOMIC_RELEASE);
+}
+
+
+#if CONFIG_CONTROL_LOOP_MODE_TASK
+
+static void _control_task(void *data) {
+
+    ESP_LOGI(tag_control, "Control task started: %d Hz (%d tick(s) period)", CONFIG_CONTROL_LOOP_RATE_HZ,
+             CONTROL_PERIOD_TICKS);
+
+    dac_output_enable(CONTROL_LOOP_OUT_CHANNEL);
+
+    TickType_t last_wake = xTaskGetTickCount();
+
+    while (1) {
+        _control_step();
+
+        // the next wake time has already passed: vTaskDelayUntil() would return at once and the loop would try to
+        // catch up with a burst of back-to-back steps. Count the overrun and skip the missed periods instead, keeping
+        // the steps on the original time grid
+        TickType_t const late = xTaskGetTickCount() - last_wake;
+        if (late >= CONTROL_PERIOD_TICKS) {
+            stats.overruns++;
+            last_wake += (late / CONTROL_PERIOD_TICKS) * CONTROL_PERIOD_TICKS;
+        }
+        vTaskDelayUntil(&last_wake, CONTROL_PERIOD_TICKS);
+    }
+}
+
+/*
+ *  Start the control task on the APP core so the Wi-Fi/lwIP stack (PRO core) doesn't steal its cycles
+ */
+void controlloop_start(void) {
+    _params_init();
+    _engine_init();
+    xTaskCreatePinnedToCore(_control_task, "_control_task", CONTROL_TASK_STACK_SIZE, NULL, CONTROL_TASK_PRIORITY,
+                            NULL, APP_CPU_NUM);
+}
+
+#else  // CONFIG_CONTROL_LOOP_MODE_TIMER
+
+static esp_timer_handle_t control_timer;
+
+static void IRAM_ATTR _control_timer_cb(void *arg) {
+    int64_t const step_prev_start_us = step_prev_us;
+
+    _control_step();
+
+    // esp_timer fires late callbacks back-to-back, so a step coming more than half a period after it was due means
+    // the deadline has been missed
+    if ((step_prev_start_us != 0) && (step_prev_us - step_prev_start_us > CONTROL_PERIOD_US + CONTROL_PERIOD_US/2)) {
+        stats.overruns++;
+    }
+}
+
+void controlloop_start(void) {
+    ESP_LOGI(tag_control, "Control timer started: %d Hz (%d us period)", CONFIG_CONTROL_LOOP_RATE_HZ,
+             CONTROL_PERIOD_US);
+
+    dac_output_enable(CONTROL_LOOP_OUT_CHANNEL);
+    _params_init();
+    _engine_init();
+
+    // task dispatch: the callback runs in the esp_timer task, so the regular (not ISR-safe) DAC driver may be used
+    esp_timer_create_args_t const timer_args = {
+        .callback = _control_timer_cb,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "control"
+    };
+    ESP_ERROR_CHECK( esp_timer_create(&timer_args, &control_timer) );
+    ESP_ERROR_CHECK( esp_timer_start_periodic(control_timer, CONTROL_PERIOD_US) );
+}
+
+#endif
+
+
+void controlloop_get_stats(controlloop_stats_t *stats_out, bool reset) {
+    memcpy(stats_out, &stats, sizeof(controlloop_stats_t));
+    if (stats_out->iterations < 2) {  // no period measured yet
+        stats_out->period_min_us = 0;
+    }
+    else {
+        stats_out->jitter_rms_us = sqrtf(jitter_sq_sum_us2 / (stats_out->iterations - 1));
+    }
+    if (reset) {
+        stats_reset_req = true;
+    }
+}
+
+
+/*
+ *  Publish a complete parameter set of the single loop, applied to pid_data at the start of the next step (gains that
+ *  are scheduled get overridden by the schedule right away). With reset_err_I the accumulated integral error is zeroed
+ *  in the same step
+ */
+esp_err_t controlloop_set_params(const controlloop_params_t *params, bool reset_err_I) {
+
+    int slot_idx;
+    esp_err_t const err = _swap_wait_free(&params_swap, &slot_idx);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    memcpy(&params_slots[slot_idx].params, params, sizeof(controlloop_params_t));
+    params_slots[slot_idx].reset_err_I = reset_err_I;
+    _swap_publish(&params_swap);
+    return ESP_OK;
+}
+
+/*
+ *  The last published parameter set, the base for changing some of the values
+ */
+void controlloop_get_params(controlloop_params_t *params) {
+    memcpy(params, &params_slots[_swap_acquire(&params_swap) & 1].params, sizeof(controlloop_params_t));
+}
+
+/*
+ *  Consistent snapshot of pid_data as the single loop is using it
+ */
+void controlloop_get_pid(PIDdata *pid) {
+    while (1) {
+        uint32_t const seq = __atomic_load_n(&live_seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            continue;
+        }
+        memcpy(pid, p_pid_data, sizeof(PIDdata));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&live_seq, __ATOMIC_RELAXED) == seq) {
+            return;
+        }
+    }
+}
+
+
+/*
+ *  Replace the gain schedule of the single loop, taking effect from the next step (NULL or PID_SCHEDULE_OFF turns
+ *  scheduling off and the gains applied last stay in effect)
+ */
+esp_err_t controlloop_set_schedule(const PIDschedule *schedule) {
+
+    int slot_idx;
+    esp_err_t const err = _swap_wait_free(&schedule_swap, &slot_idx);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    if (schedule != NULL) {
+        memcpy(&schedule_slots[slot_idx], schedule, sizeof(PIDschedule));
+    }
+    else {
+        PID_ScheduleInit(&schedule_slots[slot_idx]);
+    }
+    _swap_publish(&schedule_swap);
+    return ESP_OK;
+}
+
+void controlloop_get_schedule(PIDschedule *schedule) {
+    memcpy(schedule, &schedule_slots[_swap_acquire(&schedule_swap) & 1], sizeof(PIDschedule));
+}
+
+
+/*
+ *  Replace the control pipeline with the given cascade, which starts from the next step with its state as passed
+ *  (NULL or zero stages return to the single loop on pid_data). Every stage's process variable channel has to be in
+ *  the sampler's scan list
+ */
+esp_err_t controlloop_set_cascade(const controlloop_cascade_t *cascade) {
+
+    if (cascade != NULL) {
+        for (int i = 0; i < cascade->pid.n; i++) {
+            if (!sampler_is_scanned(cascade->pv_channel[i])) {
+                return ESP_ERR_INVALID_ARG;
+            }
+        }
+    }
+
+    int slot_idx;
+    esp_err_t const err = _swap_wait_free(&cascade_swap, &slot_idx);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    if (cascade != NULL) {
+        memcpy(&cascade_slots[slot_idx], cascade, sizeof(controlloop_cascade_t));
+    }
+    else {
+        memset(&cascade_slots[slot_idx], 0, sizeof(controlloop_cascade_t));
+    }
+    _swap_publish(&cascade_swap);
+    return ESP_OK;
+}
+
+/*
+ *  Copy of the running cascade including its live state (which the step keeps updating, so the stages may come from
+ *  adjacent steps)
+ */
+void controlloop_get_cascade(controlloop_cascade_t *cascade) {
+    memcpy(cascade, &cascade_slots[_swap_acquire(&cascade_swap) & 1], sizeof(controlloop_cascade_t));
+}
+
+
+void controlloop_get_values(float *pv, float *out) {
+    *pv = process_variable;
+    *out = controller_output;
+}
+
+/*
+ *  Number of the step the ring will take next, the slots of the CONFIG_CONTROL_LOOP_RING_LEN steps before it can be
+ *  read
+ */
+uint32_t controlloop_ring_head(void) {
+    return __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+}
+
+const controlloop_point_t *controlloop_ring_slot(uint32_t seq) {
+    return &ring[seq & RING_MASK];
+}
+
+// start of the step (esp_timer, lower 32 bits)
+uint32_t controlloop_ring_timestamp(uint32_t seq) {
+    return ring_timestamp[seq & RING_MASK];
+}
+
+const controlloop_terms_t *controlloop_ring_terms(uint32_t seq) {
+    return &ring_terms[seq & RING_MASK];
+}
+
+bool controlloop_ring_valid(uint32_t seq) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&ring_seq[seq & RING_MASK], __ATOMIC_RELAXED) == seq;
+}
+
+
+void controlloop_get_totals(controlloop_totals_t *totals_out) {
+    while (1) {
+        uint32_t const seq = __atomic_load_n(&totals_seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            continue;
+        }
+        memcpy(totals_out, &totals, sizeof(controlloop_totals_t));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&totals_seq, __ATOMIC_RELAXED) == seq) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,138 @@
+//
+//  controlloop.h
+//  pid-controller-server
+//
+//  Fixed-rate control loop: samples the process variable, runs PID_Update() and drives the controller output. Runs in
+//  a dedicated task (CONFIG_CONTROL_LOOP_MODE_TASK) or from a high-resolution esp_timer
+//  (CONFIG_CONTROL_LOOP_MODE_TIMER)
+//
+
+#ifndef controlloop_h
+#define controlloop_h
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "driver/adc.h"
+#include "driver/dac.h"
+
+#include "esp_timer.h"
+#include "esp_attr.h"
+#include "esp_err.h"
+#include "esp_log.h"
+
+#include "pid.h"
+#include "pid_velocity.h"
+#include "pid_schedule.h"
+#include "pid_cascade.h"
+#include "sampler.h"
+
+
+#define CONTROL_LOOP_PV_CHANNEL ADC1_CHANNEL_0  // process variable input
+#define CONTROL_LOOP_OUT_CHANNEL DAC_CHANNEL_1  // controller output (GPIO25)
+
+
+typedef struct controlloop_stats {
+    uint32_t iterations;  // control steps since the last reset of the statistics
+    uint32_t overruns;  // steps that did not finish before the next one was due
+    int32_t period_nominal_us;
+    float period_avg_us;  // achieved period, measured between consecutive step starts
+    int32_t period_min_us;
+    int32_t period_max_us;
+    int32_t jitter_max_us;  // largest deviation of the achieved period from the nominal one
+    float jitter_rms_us;
+} controlloop_stats_t;
+
+
+/*
+ *  Running totals of the step values since the start, the integrator stage of a CIC decimator: the difference of two
+ *  snapshots divided by the difference of their step counts is the average over the steps in between, so any number
+ *  of readers can decimate at rates of their own. The sums are in 1/CONTROLLOOP_TOTALS_SCALE units (values are taken
+ *  as int32_t, saturated at +-2^23) and wrap around, only differences are meaningful
+ */
+#define CONTROLLOOP_TOTALS_SCALE 256.0f
+
+typedef struct controlloop_totals {
+    uint32_t steps;
+    uint64_t pv_sum;
+    uint64_t out_sum;
+    int64_t timestamp_us;  // start of the last step
+} controlloop_totals_t;
+
+
+/*
+ *  Ring of the values of the last CONFIG_CONTROL_LOOP_RING_LEN steps, written by the step and read by any number of
+ *  readers, each one at its own position. A slot is exactly a stream point, so a run of slots can be handed to the
+ *  network as it is; as the step never waits, readers check with controlloop_ring_valid() (after the use) that the
+ *  slot has not been overwritten meanwhile
+ */
+typedef struct controlloop_point {
+    float process_variable;
+    float controller_output;  // as applied to the DAC, clamped to 0..4095
+} controlloop_point_t;
+
+/*
+ *  Internal terms of the controller at a step, kept by the ring next to the point (for a cascade, of its innermost
+ *  stage). The velocity-form engine has no integral state, its err_I is NaN, and its err_D is the change of the error
+ *  instead of the (negative) change of the process variable
+ */
+typedef struct controlloop_terms {
+    float setpoint;
+    float err_P;
+    float err_I;
+    float err_D;
+} controlloop_terms_t;
+
+
+/*
+ *  Cascade pipeline (see PID_CascadeUpdate()): the controllers and where each one takes its process variable from
+ */
+typedef struct controlloop_cascade {
+    PIDcascade pid;
+    adc1_channel_t pv_channel[PID_CASCADE_STAGES_MAX];
+} controlloop_cascade_t;
+
+
+/*
+ *  Parameters of the single loop as exchanged with the clients
+ */
+typedef struct controlloop_params {
+    float setpoint;
+    float kP;
+    float kI;
+    float kD;
+    float err_P_limits[2];
+    float err_I_limits[2];
+} controlloop_params_t;
+
+
+void controlloop_start(void);
+
+void controlloop_get_stats(controlloop_stats_t *stats, bool reset);
+void controlloop_get_values(float *process_variable, float *controller_output);
+void controlloop_get_totals(controlloop_totals_t *totals);
+
+uint32_t controlloop_ring_head(void);
+const controlloop_point_t *controlloop_ring_slot(uint32_t seq);
+uint32_t controlloop_ring_timestamp(uint32_t seq);
+const controlloop_terms_t *controlloop_ring_terms(uint32_t seq);
+bool controlloop_ring_valid(uint32_t seq);
+
+esp_err_t controlloop_set_params(const controlloop_params_t *params, bool reset_err_I);
+void controlloop_get_params(controlloop_params_t *params);
+void controlloop_get_pid(PIDdata *pid);
+
+esp_err_t controlloop_set_schedule(const PIDschedule *schedule);
+void controlloop_get_schedule(PIDschedule *schedule);
+
+esp_err_t controlloop_set_cascade(const controlloop_cascade_t *cascade);
+void controlloop_get_cascade(controlloop_cascade_t *cascade);
+
+
+#endif /* controlloop_h */
@@ -2,30 +2,90 @@
 #define PID_H
 
 
+#include <stdint.h>
 #include <string.h>
 
+#include "sdkconfig.h"
+#include "esp_attr.h"
+
+
+/*
+ *  Engine number format, selected at build time. With CONFIG_PID_FIXED_POINT signals (setpoint, process variable,
+ *  errors, limits, output) are Q15 (range +-65536) and gains are Q16 (range +-32768), all arithmetic is integer and
+ *  saturating. Otherwise everything is a plain float. The FROM_FLOAT/TO_FLOAT conversions are no-ops in the float
+ *  build, so the rest of the firmware (and the UDP protocol) keeps exchanging floats either way
+ */
+#if CONFIG_PID_FIXED_POINT
+
+typedef int32_t pid_value_t;
+typedef int32_t pid_gain_t;
+
+#define PID_VALUE_FRAC_BITS 15
+#define PID_GAIN_FRAC_BITS 16
+
+// for static initializers
+#define PID_VALUE_CONST(x) ((pid_value_t)((x) * (1 << PID_VALUE_FRAC_BITS) + (((x) >= 0) ? 0.5 : -0.5)))
+#define PID_GAIN_CONST(x) ((pid_gain_t)((x) * (1 << PID_GAIN_FRAC_BITS) + (((x) >= 0) ? 0.5 : -0.5)))
+
+#define PID_VALUE_FROM_FLOAT(x) PID_FixedFromFloat((x), PID_VALUE_FRAC_BITS)
+#define PID_VALUE_TO_FLOAT(x) ((float)(x) * (1.0f / (1 << PID_VALUE_FRAC_BITS)))
+#define PID_GAIN_FROM_FLOAT(x) PID_FixedFromFloat((x), PID_GAIN_FRAC_BITS)
+#define PID_GAIN_TO_FLOAT(x) ((float)(x) * (1.0f / (1 << PID_GAIN_FRAC_BITS)))
+
+/*
+ *  Round to the nearest representable value, saturate out-of-range ones
+ */
+static inline int32_t PID_FixedFromFloat(float x, int frac_bits) {
+    float const scaled = x * (float)(1 << frac_bits);
+    if (scaled != scaled) {  // NaN
+        return 0;
+    }
+    if (scaled >= 2147483647.0f) {
+        return INT32_MAX;
+    }
+    if (scaled <= -2147483648.0f) {
+        return INT32_MIN;
+    }
+    return (int32_t)((scaled >= 0.0f) ? (scaled + 0.5f) : (scaled - 0.5f));
+}
+
+#else
+
+typedef float pid_value_t;
+typedef float pid_gain_t;
+
+#define PID_VALUE_CONST(x) (x)
+#define PID_GAIN_CONST(x) (x)
+
+#define PID_VALUE_FROM_FLOAT(x) (x)
+#define PID_VALUE_TO_FLOAT(x) (x)
+#define PID_GAIN_FROM_FLOAT(x) (x)
+#define PID_GAIN_TO_FLOAT(x) (x)
+
+#endif
+
 
 typedef struct _PIDdata {
 
-    float _input_prev;
+    pid_value_t _input_prev;
 
-    float setpoint;
+    pid_value_t setpoint;
 
     // PID factors
-    float kP;
-    float kI;
-    float kD;
+    pid_gain_t kP;
+    pid_gain_t kI;
+    pid_gain_t kD;
 
     // PID terms
-    float Perr;
-    float Ierr;
-    float Derr;
+    pid_value_t Perr;
+    pid_value_t Ierr;
+    pid_value_t Derr;
 
     // PID terms limits
-    float Perrmin;
-    float Perrmax;
-    float Ierrmin;
-    float Ierrmax;
+    pid_value_t Perrmin;
+    pid_value_t Perrmax;
+    pid_value_t Ierrmin;
+    pid_value_t Ierrmax;
 } PIDdata;
 typedef PIDdata *ptrPIDdata;
 
@@ -42,7 +102,7 @@ void PID_Coefficients(ptrPIDdata pPd, float setpoint, float kP, float kI, float
 void PID_SetLimitsPerr(ptrPIDdata pPd, float Perr_min, float Perr_max);
 void PID_SetLimitsIerr(ptrPIDdata pPd, float Ierr_min, float Ierr_max);
 void PID_ResetIerr(ptrPIDdata pPd);
-float PID_Update(ptrPIDdata pPd, float input);
+pid_value_t PID_Update(ptrPIDdata pPd, pid_value_t input);
 
 
 #endif /* PID_H */
@@ -0,0 +1,57 @@
+#ifndef PID_BATCH_H
+#define PID_BATCH_H
+
+
+#include "pid.h"
+
+
+#define PID_BATCH_MAX 64  // capacity, a multiple of the widest SIMD vector (8 floats)
+#define PID_BATCH_ALIGN 32
+
+
+/*
+ *  N controllers stored as parallel arrays (structure of arrays) so one PID_BatchUpdate() call can process them
+ *  several lanes at a time. Each array holds the same field as PIDdata does for a single controller
+ */
+typedef struct _PIDbatch {
+
+    int n;
+
+    float _input_prev[PID_BATCH_MAX] __attribute__((aligned(PID_BATCH_ALIGN)));
+
+    float setpoint[PID_BATCH_MAX] __attribute__((aligned(PID_BATCH_ALIGN)));
+
+    // PID factors
+    float kP[PID_BATCH_MAX] __attribute__((aligned(PID_BATCH_ALIGN)));
+    float kI[PID_BATCH_MAX] __attribute__((aligned(PID_BATCH_ALIGN)));
+    float kD[PID_BATCH_MAX] __attribute__((aligned(PID_BATCH_ALIGN)));
+
+    // PID terms
+    float Perr[PID_BATCH_MAX] __attribute__((aligned(PID_BATCH_ALIGN)));
+    float Ierr[PID_BATCH_MAX] __attribute__((aligned(PID_BATCH_ALIGN)));
+    float Derr[PID_BATCH_MAX] __attribute__((aligned(PID_BATCH_ALIGN)));
+
+    // PID terms limits
+    float Perrmin[PID_BATCH_MAX] __attribute__((aligned(PID_BATCH_ALIGN)));
+    float Perrmax[PID_BATCH_MAX] __attribute__((aligned(PID_BATCH_ALIGN)));
+    float Ierrmin[PID_BATCH_MAX] __attribute__((aligned(PID_BATCH_ALIGN)));
+    float Ierrmax[PID_BATCH_MAX] __attribute__((aligned(PID_BATCH_ALIGN)));
+} PIDbatch;
+typedef PIDbatch *ptrPIDbatch;
+
+
+int PID_BatchInit(ptrPIDbatch pPb, int n);
+void PID_BatchLoad(ptrPIDbatch pPb, int idx, const PIDdata *pPd);
+void PID_BatchStore(const PIDbatch *pPb, int idx, ptrPIDdata pPd);
+
+void PID_BatchCoefficients(ptrPIDbatch pPb, int idx, float setpoint, float kP, float kI, float kD);
+void PID_BatchSetLimitsPerr(ptrPIDbatch pPb, int idx, float Perr_min, float Perr_max);
+void PID_BatchSetLimitsIerr(ptrPIDbatch pPb, int idx, float Ierr_min, float Ierr_max);
+void PID_BatchResetIerr(ptrPIDbatch pPb, int idx);
+
+void PID_BatchUpdate(ptrPIDbatch pPb, const float *inputs, float *outputs);
+void PID_BatchUpdateScalar(ptrPIDbatch pPb, const float *inputs, float *outputs);
+const char *PID_BatchImplementation(void);
+
+
+#endif /* PID_BATCH_H */
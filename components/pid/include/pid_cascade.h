@@ -0,0 +1,38 @@
+#ifndef PID_CASCADE_H
+#define PID_CASCADE_H
+
+
+#include <stdbool.h>
+
+#include "pid.h"
+
+
+#define PID_CASCADE_STAGES_MAX 4
+
+
+/*
+ *  Cascade of controllers, outermost first: the output of every stage becomes the setpoint of the next one and the
+ *  last stage's output drives the actuator. A stage runs once every 'divider' control ticks; the dividers must be
+ *  nested (each one a multiple of the next), so inner stages run at whole multiples of the outer rate and always in
+ *  the same tick as the outer stage feeding them. All the state is kept in this one block
+ */
+typedef struct _PIDcascade {
+
+    int n;
+
+    uint16_t divider[PID_CASCADE_STAGES_MAX];
+    uint16_t countdown[PID_CASCADE_STAGES_MAX];  // ticks until the stage is due, 0 = this tick
+
+    pid_value_t output[PID_CASCADE_STAGES_MAX];  // last output of every stage
+
+    PIDdata stage[PID_CASCADE_STAGES_MAX];
+} PIDcascade;
+typedef PIDcascade *ptrPIDcascade;
+
+
+int PID_CascadeInit(ptrPIDcascade pPc, int n);
+bool PID_CascadeSetDividers(ptrPIDcascade pPc, const uint16_t *dividers);
+pid_value_t PID_CascadeUpdate(ptrPIDcascade pPc, const pid_value_t *inputs);
+
+
+#endif /* PID_CASCADE_H */
@@ -0,0 +1,51 @@
+#ifndef PID_SCHEDULE_H
+#define PID_SCHEDULE_H
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_attr.h"
+
+
+#define PID_SCHEDULE_POINTS_MAX 16
+
+
+/*
+ *  What the gains are scheduled by
+ */
+enum {
+    PID_SCHEDULE_OFF,
+    PID_SCHEDULE_BY_SETPOINT,
+    PID_SCHEDULE_BY_PV
+};
+
+
+/*
+ *  Gain schedule: kP/kI/kD given at points uniformly spaced over [x_min, x_max] and linearly interpolated in between.
+ *  The uniform grid makes the segment lookup a single multiplication (no search), the per-segment slopes are
+ *  precomputed when the table is set so interpolating is one multiply-add per gain. Outside the range the gains of the
+ *  nearest end point hold
+ */
+typedef struct _PIDschedule {
+
+    uint8_t source;
+    uint8_t points;
+
+    float x_min;
+    float x_max;
+    float inv_step;  // (points - 1) / (x_max - x_min)
+
+    // kP, kI, kD at every point and their increments towards the next one
+    float gains[PID_SCHEDULE_POINTS_MAX][3];
+    float slopes[PID_SCHEDULE_POINTS_MAX][3];
+} PIDschedule;
+typedef PIDschedule *ptrPIDschedule;
+
+
+void PID_ScheduleInit(ptrPIDschedule pS);
+bool PID_ScheduleSet(ptrPIDschedule pS, uint8_t source, float x_min, float x_max, int points, const float *gains);
+void PID_ScheduleLookup(const PIDschedule *pS, float x, float *kP, float *kI, float *kD);
+
+
+#endif /* PID_SCHEDULE_H */
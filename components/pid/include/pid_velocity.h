@@ -0,0 +1,53 @@
+#ifndef PID_VELOCITY_H
+#define PID_VELOCITY_H
+
+
+#include "pid.h"
+
+
+/*
+ *  Incremental (velocity-form) PID: every step adds the change of the output to the previous one,
+ *
+ *      u[k] = u[k-1] + a0*e[k] + a1*e[k-1] + a2*e[k-2]
+ *
+ *  with a0 = kP + kI*dt + kD/dt, a1 = -kP - 2*kD/dt, a2 = kD/dt precomputed whenever the gains or the sample time
+ *  change. Clamping u[k] to the output limits is the anti-windup: there is no separate integral state that could
+ *  keep growing. Note the derivative acts on the error, so setpoint steps produce a derivative kick
+ */
+typedef struct _PIDvelocity {
+
+    float setpoint;
+
+    // PID factors and the sample time they are discretized with (dt=1 gives the same per-sample gain units as
+    // PID_Update())
+    float kP;
+    float kI;
+    float kD;
+    float dt;
+
+    // precomputed coefficients
+    float a0;
+    float a1;
+    float a2;
+
+    // last two errors and the last output
+    float e1;
+    float e2;
+    float output;
+
+    // output limits
+    float outmin;
+    float outmax;
+} PIDvelocity;
+typedef PIDvelocity *ptrPIDvelocity;
+
+
+void PID_VelocityInit(ptrPIDvelocity pPv, float dt);
+void PID_VelocityCoefficients(ptrPIDvelocity pPv, float setpoint, float kP, float kI, float kD);
+void PID_VelocitySetSampleTime(ptrPIDvelocity pPv, float dt);
+void PID_VelocitySetLimits(ptrPIDvelocity pPv, float out_min, float out_max);
+void PID_VelocityReset(ptrPIDvelocity pPv, float output);
+float PID_VelocityUpdate(ptrPIDvelocity pPv, float input);
+
+
+#endif /* PID_VELOCITY_H */
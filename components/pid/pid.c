@@ -2,16 +2,16 @@
 
 
 PIDdata pid_defaults = {
-    .setpoint = 1234.0f,
+    .setpoint = PID_VALUE_CONST(1234.0f),
 
-    .kP = 123.4f,
-    .kI = 12.34f,
-    .kD = 1.234f,
+    .kP = PID_GAIN_CONST(123.4f),
+    .kI = PID_GAIN_CONST(12.34f),
+    .kD = PID_GAIN_CONST(1.234f),
 
-    .Perrmin = -12345.0f,
-    .Perrmax = 12345.0f,
-    .Ierrmin = -54321.0f,
-    .Ierrmax = 54321.0f
+    .Perrmin = PID_VALUE_CONST(-12345.0f),
+    .Perrmax = PID_VALUE_CONST(12345.0f),
+    .Ierrmin = PID_VALUE_CONST(-54321.0f),
+    .Ierrmax = PID_VALUE_CONST(54321.0f)
 };
 ptrPIDdata p_pid_defaults = &pid_defaults;
 
@@ -46,11 +46,11 @@ void PID_Init(ptrPIDdata pPd) {
  */
 void PID_Coefficients(ptrPIDdata pPd, float setpoint, float kP, float kI, float kD) {
 
-    pPd->setpoint = setpoint;
+    pPd->setpoint = PID_VALUE_FROM_FLOAT(setpoint);
 
-    pPd->kP = kP;
-    pPd->kI = kI;
-    pPd->kD = kD;
+    pPd->kP = PID_GAIN_FROM_FLOAT(kP);
+    pPd->kI = PID_GAIN_FROM_FLOAT(kI);
+    pPd->kD = PID_GAIN_FROM_FLOAT(kD);
 }
 
 
@@ -58,8 +58,8 @@ void PID_Coefficients(ptrPIDdata pPd, float setpoint, float kP, float kI, float
  *  Set proportional term limits
  */
 void PID_SetLimitsPerr(ptrPIDdata pPd, float Perr_min, float Perr_max) {
-    pPd->Perrmin = Perr_min;
-    pPd->Perrmax = Perr_max;
+    pPd->Perrmin = PID_VALUE_FROM_FLOAT(Perr_min);
+    pPd->Perrmax = PID_VALUE_FROM_FLOAT(Perr_max);
 }
 
 
@@ -67,8 +67,8 @@ void PID_SetLimitsPerr(ptrPIDdata pPd, float Perr_min, float Perr_max) {
  *  Set integral term limits
  */
 void PID_SetLimitsIerr(ptrPIDdata pPd, float Ierr_min, float Ierr_max) {
-    pPd->Ierrmin = Ierr_min;
-    pPd->Ierrmax = Ierr_max;
+    pPd->Ierrmin = PID_VALUE_FROM_FLOAT(Ierr_min);
+    pPd->Ierrmax = PID_VALUE_FROM_FLOAT(Ierr_max);
 }
 
 
@@ -76,15 +76,60 @@ void PID_SetLimitsIerr(ptrPIDdata pPd, float Ierr_min, float Ierr_max) {
  *  Reset integral term accumulated error
  */
 void PID_ResetIerr(ptrPIDdata pPd) {
-    pPd->Ierr = 0.0f;
+    pPd->Ierr = PID_VALUE_CONST(0.0f);
 }
 
 
+#if CONFIG_PID_FIXED_POINT
+
+static inline int32_t _sat32(int64_t x) {
+    return (x > INT32_MAX) ? INT32_MAX : ((x < INT32_MIN) ? INT32_MIN : (int32_t)x);
+}
+
+// gain (Q16) * term (Q15), rounded back to Q15. At most 47 significant bits, so three of them can be summed safely
+static inline int64_t _mul_gain(pid_gain_t gain, pid_value_t term) {
+    return ((int64_t)gain * term + (1 << (PID_GAIN_FRAC_BITS - 1))) >> PID_GAIN_FRAC_BITS;
+}
+
+/*
+ *  PID control algorithm, fixed-point variant: same steps as the float one with saturating integer arithmetic
+ */
+pid_value_t IRAM_ATTR PID_Update(ptrPIDdata pPd, pid_value_t input) {
+
+    // compute P error
+    pPd->Perr = _sat32((int64_t)pPd->setpoint - input);
+    if (pPd->Perr < pPd->Perrmin) {
+        pPd->Perr = pPd->Perrmin;
+    }
+    else if (pPd->Perr > pPd->Perrmax) {
+        pPd->Perr = pPd->Perrmax;
+    }
+
+    // compute I error
+    pPd->Ierr = _sat32((int64_t)pPd->Ierr + pPd->Perr);
+    if (pPd->Ierr < pPd->Ierrmin) {
+        pPd->Ierr = pPd->Ierrmin;
+    }
+    else if (pPd->Ierr > pPd->Ierrmax) {
+        pPd->Ierr = pPd->Ierrmax;
+    }
+
+    // compute D error
+    pPd->Derr = _sat32((int64_t)pPd->_input_prev - input);
+
+    // record last value
+    pPd->_input_prev = input;
+
+    return _sat32(_mul_gain(pPd->kP, pPd->Perr) + _mul_gain(pPd->kI, pPd->Ierr) + _mul_gain(pPd->kD, pPd->Derr));
+}
+
+#else
+
 /*
  *  PID control algorithm. If this function get called always at the same period, dt=1 can be used,
- *  otherwise it should be calculated
+ *  otherwise it should be calculated. Resides in IRAM as it is called from the control loop hot path
  */
-float PID_Update(ptrPIDdata pPd, float input) {
+pid_value_t IRAM_ATTR PID_Update(ptrPIDdata pPd, pid_value_t input) {
 
     // compute P error
     pPd->Perr = pPd->setpoint - input;
@@ -112,3 +157,5 @@ float PID_Update(ptrPIDdata pPd, float input) {
 
     return ((pPd->kP * pPd->Perr) + (pPd->kI * pPd->Ierr) + (pPd->kD * pPd->Derr));
 }
+
+#endif
@@ -0,0 +1,247 @@
+#include "pid_batch.h"
+
+
+/*
+ *  SIMD path is chosen at compile time from what the compiler targets. The ESP32 (Xtensa) has no vector unit and
+ *  always gets the scalar loop
+ */
+#if defined(PID_BATCH_FORCE_SCALAR)
+#define PID_BATCH_IMPL "scalar"
+#elif defined(__AVX__)
+#include <immintrin.h>
+#define PID_BATCH_IMPL "avx"
+#define PID_BATCH_LANES 8
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#define PID_BATCH_IMPL "sse"
+#define PID_BATCH_LANES 4
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PID_BATCH_IMPL "neon"
+#define PID_BATCH_LANES 4
+#else
+#define PID_BATCH_IMPL "scalar"
+#endif
+
+
+/*
+ *  Initialize n controllers with the same defaults PID_Init() uses. Returns the number of controllers or -1 if n
+ *  exceeds the capacity
+ */
+int PID_BatchInit(ptrPIDbatch pPb, int n) {
+
+    if ((n < 0) || (n > PID_BATCH_MAX)) {
+        return -1;
+    }
+
+    memset(pPb, 0, sizeof(PIDbatch));
+    pPb->n = n;
+
+    PIDdata defaults;
+    PID_Init(&defaults);
+    for (int i = 0; i < n; i++) {
+        PID_BatchLoad(pPb, i, &defaults);
+    }
+
+    return n;
+}
+
+/*
+ *  Copy a single controller into/from the batch (converting from/to the fixed-point format if the engine uses it)
+ */
+void PID_BatchLoad(ptrPIDbatch pPb, int idx, const PIDdata *pPd) {
+    pPb->_input_prev[idx] = PID_VALUE_TO_FLOAT(pPd->_input_prev);
+    pPb->setpoint[idx] = PID_VALUE_TO_FLOAT(pPd->setpoint);
+    pPb->kP[idx] = PID_GAIN_TO_FLOAT(pPd->kP);
+    pPb->kI[idx] = PID_GAIN_TO_FLOAT(pPd->kI);
+    pPb->kD[idx] = PID_GAIN_TO_FLOAT(pPd->kD);
+    pPb->Perr[idx] = PID_VALUE_TO_FLOAT(pPd->Perr);
+    pPb->Ierr[idx] = PID_VALUE_TO_FLOAT(pPd->Ierr);
+    pPb->Derr[idx] = PID_VALUE_TO_FLOAT(pPd->Derr);
+    pPb->Perrmin[idx] = PID_VALUE_TO_FLOAT(pPd->Perrmin);
+    pPb->Perrmax[idx] = PID_VALUE_TO_FLOAT(pPd->Perrmax);
+    pPb->Ierrmin[idx] = PID_VALUE_TO_FLOAT(pPd->Ierrmin);
+    pPb->Ierrmax[idx] = PID_VALUE_TO_FLOAT(pPd->Ierrmax);
+}
+
+void PID_BatchStore(const PIDbatch *pPb, int idx, ptrPIDdata pPd) {
+    pPd->_input_prev = PID_VALUE_FROM_FLOAT(pPb->_input_prev[idx]);
+    pPd->setpoint = PID_VALUE_FROM_FLOAT(pPb->setpoint[idx]);
+    pPd->kP = PID_GAIN_FROM_FLOAT(pPb->kP[idx]);
+    pPd->kI = PID_GAIN_FROM_FLOAT(pPb->kI[idx]);
+    pPd->kD = PID_GAIN_FROM_FLOAT(pPb->kD[idx]);
+    pPd->Perr = PID_VALUE_FROM_FLOAT(pPb->Perr[idx]);
+    pPd->Ierr = PID_VALUE_FROM_FLOAT(pPb->Ierr[idx]);
+    pPd->Derr = PID_VALUE_FROM_FLOAT(pPb->Derr[idx]);
+    pPd->Perrmin = PID_VALUE_FROM_FLOAT(pPb->Perrmin[idx]);
+    pPd->Perrmax = PID_VALUE_FROM_FLOAT(pPb->Perrmax[idx]);
+    pPd->Ierrmin = PID_VALUE_FROM_FLOAT(pPb->Ierrmin[idx]);
+    pPd->Ierrmax = PID_VALUE_FROM_FLOAT(pPb->Ierrmax[idx]);
+}
+
+
+/*
+ *  Per-controller setters, same meaning as their pid.h counterparts
+ */
+void PID_BatchCoefficients(ptrPIDbatch pPb, int idx, float setpoint, float kP, float kI, float kD) {
+    pPb->setpoint[idx] = setpoint;
+    pPb->kP[idx] = kP;
+    pPb->kI[idx] = kI;
+    pPb->kD[idx] = kD;
+}
+
+void PID_BatchSetLimitsPerr(ptrPIDbatch pPb, int idx, float Perr_min, float Perr_max) {
+    pPb->Perrmin[idx] = Perr_min;
+    pPb->Perrmax[idx] = Perr_max;
+}
+
+void PID_BatchSetLimitsIerr(ptrPIDbatch pPb, int idx, float Ierr_min, float Ierr_max) {
+    pPb->Ierrmin[idx] = Ierr_min;
+    pPb->Ierrmax[idx] = Ierr_max;
+}
+
+void PID_BatchResetIerr(ptrPIDbatch pPb, int idx) {
+    pPb->Ierr[idx] = 0.0f;
+}
+
+
+/*
+ *  Scalar loop over controllers [first, n). Computes exactly what the float PID_Update() does for each of them (as
+ *  long as the limits are ordered, min <= max) but clamps with selects instead of branches
+ */
+static void _update_scalar(ptrPIDbatch pPb, int first, const float *inputs, float *outputs) {
+
+    for (int i = first; i < pPb->n; i++) {
+        float const input = inputs[i];
+
+        // compute P error
+        float Perr = pPb->setpoint[i] - input;
+        Perr = (Perr < pPb->Perrmin[i]) ? pPb->Perrmin[i] : Perr;
+        Perr = (Perr > pPb->Perrmax[i]) ? pPb->Perrmax[i] : Perr;
+
+        // compute I error
+        float Ierr = pPb->Ierr[i] + Perr;
+        Ierr = (Ierr < pPb->Ierrmin[i]) ? pPb->Ierrmin[i] : Ierr;
+        Ierr = (Ierr > pPb->Ierrmax[i]) ? pPb->Ierrmax[i] : Ierr;
+
+        // compute D error
+        float const Derr = pPb->_input_prev[i] - input;
+
+        pPb->Perr[i] = Perr;
+        pPb->Ierr[i] = Ierr;
+        pPb->Derr[i] = Derr;
+        pPb->_input_prev[i] = input;
+
+        outputs[i] = (pPb->kP[i] * Perr) + (pPb->kI[i] * Ierr) + (pPb->kD[i] * Derr);
+    }
+}
+
+void PID_BatchUpdateScalar(ptrPIDbatch pPb, const float *inputs, float *outputs) {
+    _update_scalar(pPb, 0, inputs, outputs);
+}
+
+
+/*
+ *  Update all controllers of the batch: inputs[i] is the process variable of the i-th one, its output goes to
+ *  outputs[i]. Vector lanes mirror the scalar loop operation by operation (max/min operand order keeps the same
+ *  NaN propagation as the compare-and-select), so every path gives bit-identical results
+ */
+void PID_BatchUpdate(ptrPIDbatch pPb, const float *inputs, float *outputs) {
+
+    int i = 0;
+
+#if defined(PID_BATCH_LANES) && (PID_BATCH_LANES == 8)
+
+    for (; i + 8 <= pPb->n; i += 8) {
+        __m256 const input = _mm256_loadu_ps(&inputs[i]);
+
+        __m256 Perr = _mm256_sub_ps(_mm256_load_ps(&pPb->setpoint[i]), input);
+        Perr = _mm256_max_ps(_mm256_load_ps(&pPb->Perrmin[i]), Perr);
+        Perr = _mm256_min_ps(_mm256_load_ps(&pPb->Perrmax[i]), Perr);
+
+        __m256 Ierr = _mm256_add_ps(_mm256_load_ps(&pPb->Ierr[i]), Perr);
+        Ierr = _mm256_max_ps(_mm256_load_ps(&pPb->Ierrmin[i]), Ierr);
+        Ierr = _mm256_min_ps(_mm256_load_ps(&pPb->Ierrmax[i]), Ierr);
+
+        __m256 const Derr = _mm256_sub_ps(_mm256_load_ps(&pPb->_input_prev[i]), input);
+
+        _mm256_store_ps(&pPb->Perr[i], Perr);
+        _mm256_store_ps(&pPb->Ierr[i], Ierr);
+        _mm256_store_ps(&pPb->Derr[i], Derr);
+        _mm256_store_ps(&pPb->_input_prev[i], input);
+
+        __m256 const output = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_load_ps(&pPb->kP[i]), Perr),
+                                                          _mm256_mul_ps(_mm256_load_ps(&pPb->kI[i]), Ierr)),
+                                            _mm256_mul_ps(_mm256_load_ps(&pPb->kD[i]), Derr));
+        _mm256_storeu_ps(&outputs[i], output);
+    }
+
+#elif defined(PID_BATCH_LANES) && defined(__SSE__)
+
+    for (; i + 4 <= pPb->n; i += 4) {
+        __m128 const input = _mm_loadu_ps(&inputs[i]);
+
+        __m128 Perr = _mm_sub_ps(_mm_load_ps(&pPb->setpoint[i]), input);
+        Perr = _mm_max_ps(_mm_load_ps(&pPb->Perrmin[i]), Perr);
+        Perr = _mm_min_ps(_mm_load_ps(&pPb->Perrmax[i]), Perr);
+
+        __m128 Ierr = _mm_add_ps(_mm_load_ps(&pPb->Ierr[i]), Perr);
+        Ierr = _mm_max_ps(_mm_load_ps(&pPb->Ierrmin[i]), Ierr);
+        Ierr = _mm_min_ps(_mm_load_ps(&pPb->Ierrmax[i]), Ierr);
+
+        __m128 const Derr = _mm_sub_ps(_mm_load_ps(&pPb->_input_prev[i]), input);
+
+        _mm_store_ps(&pPb->Perr[i], Perr);
+        _mm_store_ps(&pPb->Ierr[i], Ierr);
+        _mm_store_ps(&pPb->Derr[i], Derr);
+        _mm_store_ps(&pPb->_input_prev[i], input);
+
+        __m128 const output = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(&pPb->kP[i]), Perr),
+                                                    _mm_mul_ps(_mm_load_ps(&pPb->kI[i]), Ierr)),
+                                         _mm_mul_ps(_mm_load_ps(&pPb->kD[i]), Derr));
+        _mm_storeu_ps(&outputs[i], output);
+    }
+
+#elif defined(PID_BATCH_LANES) && defined(__ARM_NEON)
+
+    for (; i + 4 <= pPb->n; i += 4) {
+        float32x4_t const input = vld1q_f32(&inputs[i]);
+        float32x4_t lim;
+
+        // vmaxq/vminq would turn NaN into NaN regardless of the operand order, so compare-and-select instead
+        float32x4_t Perr = vsubq_f32(vld1q_f32(&pPb->setpoint[i]), input);
+        lim = vld1q_f32(&pPb->Perrmin[i]);
+        Perr = vbslq_f32(vcltq_f32(Perr, lim), lim, Perr);
+        lim = vld1q_f32(&pPb->Perrmax[i]);
+        Perr = vbslq_f32(vcgtq_f32(Perr, lim), lim, Perr);
+
+        float32x4_t Ierr = vaddq_f32(vld1q_f32(&pPb->Ierr[i]), Perr);
+        lim = vld1q_f32(&pPb->Ierrmin[i]);
+        Ierr = vbslq_f32(vcltq_f32(Ierr, lim), lim, Ierr);
+        lim = vld1q_f32(&pPb->Ierrmax[i]);
+        Ierr = vbslq_f32(vcgtq_f32(Ierr, lim), lim, Ierr);
+
+        float32x4_t const Derr = vsubq_f32(vld1q_f32(&pPb->_input_prev[i]), input);
+
+        vst1q_f32(&pPb->Perr[i], Perr);
+        vst1q_f32(&pPb->Ierr[i], Ierr);
+        vst1q_f32(&pPb->Derr[i], Derr);
+        vst1q_f32(&pPb->_input_prev[i], input);
+
+        // separate multiplies and adds (no vmlaq/vfmaq) to round the same way as the scalar expression
+        float32x4_t const output = vaddq_f32(vaddq_f32(vmulq_f32(vld1q_f32(&pPb->kP[i]), Perr),
+                                                       vmulq_f32(vld1q_f32(&pPb->kI[i]), Ierr)),
+                                             vmulq_f32(vld1q_f32(&pPb->kD[i]), Derr));
+        vst1q_f32(&outputs[i], output);
+    }
+
+#endif
+
+    // remaining controllers (or all of them without SIMD)
+    _update_scalar(pPb, i, inputs, outputs);
+}
+
+
+const char *PID_BatchImplementation(void) {
+    return PID_BATCH_IMPL;
+}
@@ -0,0 +1,63 @@
+#include "pid_cascade.h"
+
+
+/*
+ *  Initialize n stages with the PID_Init() defaults, all of them running every tick. Returns the number of stages or
+ *  -1 if n exceeds the capacity. Set up the stages through the regular PID_*() functions on &pPc->stage[i]; the
+ *  setpoints of all but the first one are overwritten by the cascade
+ */
+int PID_CascadeInit(ptrPIDcascade pPc, int n) {
+
+    if ((n < 0) || (n > PID_CASCADE_STAGES_MAX)) {
+        return -1;
+    }
+
+    memset(pPc, 0, sizeof(PIDcascade));
+    pPc->n = n;
+    for (int i = 0; i < n; i++) {
+        PID_Init(&pPc->stage[i]);
+        pPc->divider[i] = 1;
+    }
+    return n;
+}
+
+
+/*
+ *  Set the rate dividers of all stages and restart their phase. Returns false (leaving the cascade untouched) if
+ *  they are not nested
+ */
+bool PID_CascadeSetDividers(ptrPIDcascade pPc, const uint16_t *dividers) {
+
+    for (int i = 0; i < pPc->n; i++) {
+        if ((dividers[i] == 0) || ((i > 0) && ((dividers[i - 1] % dividers[i]) != 0))) {
+            return false;
+        }
+    }
+
+    for (int i = 0; i < pPc->n; i++) {
+        pPc->divider[i] = dividers[i];
+        pPc->countdown[i] = 0;
+    }
+    return true;
+}
+
+
+/*
+ *  One control tick: run the stages that are due, outermost first, with inputs[i] being the process variable of
+ *  stage i (only read when the stage runs). Returns the output of the last stage, which holds between its runs
+ */
+pid_value_t IRAM_ATTR PID_CascadeUpdate(ptrPIDcascade pPc, const pid_value_t *inputs) {
+
+    for (int i = 0; i < pPc->n; i++) {
+        if (pPc->countdown[i] == 0) {
+            pPc->countdown[i] = pPc->divider[i];
+            pPc->output[i] = PID_Update(&pPc->stage[i], inputs[i]);
+            if (i + 1 < pPc->n) {
+                pPc->stage[i + 1].setpoint = pPc->output[i];
+            }
+        }
+        pPc->countdown[i]--;
+    }
+
+    return pPc->output[pPc->n - 1];
+}
@@ -0,0 +1,68 @@
+#include <string.h>
+#include <math.h>
+
+#include "pid_schedule.h"
+
+
+/*
+ *  Empty schedule (PID_SCHEDULE_OFF)
+ */
+void PID_ScheduleInit(ptrPIDschedule pS) {
+    memset(pS, 0, sizeof(PIDschedule));
+}
+
+
+/*
+ *  Set the table: 'points' triples of kP, kI, kD for the uniformly spaced values of the scheduling variable from x_min
+ *  to x_max. Returns false (leaving the schedule untouched) if the table is malformed
+ */
+bool PID_ScheduleSet(ptrPIDschedule pS, uint8_t source, float x_min, float x_max, int points, const float *gains) {
+
+    if (((source != PID_SCHEDULE_BY_SETPOINT) && (source != PID_SCHEDULE_BY_PV)) ||
+        (points < 2) || (points > PID_SCHEDULE_POINTS_MAX) ||
+        !isfinite(x_min) || !isfinite(x_max) || !(x_max > x_min)) {
+        return false;
+    }
+    for (int i = 0; i < points * 3; i++) {
+        if (!isfinite(gains[i])) {
+            return false;
+        }
+    }
+
+    pS->source = source;
+    pS->points = points;
+    pS->x_min = x_min;
+    pS->x_max = x_max;
+    pS->inv_step = (points - 1) / (x_max - x_min);
+
+    memcpy(pS->gains, gains, points * 3 * sizeof(float));
+    for (int i = 0; i < points; i++) {
+        for (int k = 0; k < 3; k++) {
+            // the last point has no segment after it, a zero slope lets the lookup use it for the upper end too
+            pS->slopes[i][k] = (i < points - 1) ? (pS->gains[i + 1][k] - pS->gains[i][k]) : 0.0f;
+        }
+    }
+    return true;
+}
+
+
+/*
+ *  Interpolated gains at x. Must only be called for a set schedule
+ */
+void IRAM_ATTR PID_ScheduleLookup(const PIDschedule *pS, float x, float *kP, float *kI, float *kD) {
+
+    float pos = (x - pS->x_min) * pS->inv_step;
+    if (!(pos > 0.0f)) {  // below the range (or NaN)
+        pos = 0.0f;
+    }
+    else if (pos > (float)(pS->points - 1)) {
+        pos = (float)(pS->points - 1);
+    }
+
+    int const seg = (int)pos;
+    float const frac = pos - (float)seg;
+
+    *kP = pS->gains[seg][0] + (frac * pS->slopes[seg][0]);
+    *kI = pS->gains[seg][1] + (frac * pS->slopes[seg][1]);
+    *kD = pS->gains[seg][2] + (frac * pS->slopes[seg][2]);
+}
@@ -0,0 +1,92 @@
+#include <float.h>
+
+#include "pid_velocity.h"
+
+
+static void _precompute(ptrPIDvelocity pPv) {
+    float const kD_dt = pPv->kD / pPv->dt;
+
+    pPv->a0 = pPv->kP + (pPv->kI * pPv->dt) + kD_dt;
+    pPv->a1 = -pPv->kP - (2.0f * kD_dt);
+    pPv->a2 = kD_dt;
+}
+
+
+/*
+ *  Zero gains and state, unlimited output
+ */
+void PID_VelocityInit(ptrPIDvelocity pPv, float dt) {
+    memset(pPv, 0, sizeof(PIDvelocity));
+    pPv->dt = dt;
+    pPv->outmin = -FLT_MAX;
+    pPv->outmax = FLT_MAX;
+    _precompute(pPv);
+}
+
+
+/*
+ *  Set coefficients
+ */
+void PID_VelocityCoefficients(ptrPIDvelocity pPv, float setpoint, float kP, float kI, float kD) {
+
+    pPv->setpoint = setpoint;
+
+    pPv->kP = kP;
+    pPv->kI = kI;
+    pPv->kD = kD;
+
+    _precompute(pPv);
+}
+
+
+/*
+ *  Set sample time (in the units the gains are expressed with)
+ */
+void PID_VelocitySetSampleTime(ptrPIDvelocity pPv, float dt) {
+    pPv->dt = dt;
+    _precompute(pPv);
+}
+
+
+/*
+ *  Set output limits
+ */
+void PID_VelocitySetLimits(ptrPIDvelocity pPv, float out_min, float out_max) {
+    pPv->outmin = out_min;
+    pPv->outmax = out_max;
+}
+
+
+/*
+ *  Restart from the given output (e.g. the current actuator value, for a bumpless transfer)
+ */
+void PID_VelocityReset(ptrPIDvelocity pPv, float output) {
+    pPv->e1 = 0.0f;
+    pPv->e2 = 0.0f;
+    pPv->output = output;
+}
+
+
+/*
+ *  Incremental PID step: three multiply-accumulates and the output clamp. The increment is summed on its own and the
+ *  clamp branches as in PID_Update(), so little more than one add waits for the previous step's output
+ */
+float IRAM_ATTR PID_VelocityUpdate(ptrPIDvelocity pPv, float input) {
+
+    float const e = pPv->setpoint - input;
+
+    float const delta = (pPv->a0 * e) + (pPv->a1 * pPv->e1) + (pPv->a2 * pPv->e2);
+    float output = pPv->output + delta;
+    if (output < pPv->outmin) {
+        output = pPv->outmin;
+    }
+    else if (output > pPv->outmax) {
+        output = pPv->outmax;
+    }
+
+    pPv->e2 = pPv->e1;
+    pPv->e1 = e;
+    pPv->output = output;
+
+    return output;
+}
@@ -0,0 +1,55 @@
+//
+//  sampler.h
+//  pid-controller-server
+//
+//  Continuous ADC1 sampling: the converter is driven through I2S DMA over a scan list of channels, conversions are
+//  oversampled and decimated into averaged, timestamped frames consumers can read without any driver calls
+//
+
+#ifndef sampler_h
+#define sampler_h
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "driver/adc.h"
+#include "driver/i2s.h"
+#include "soc/syscon_struct.h"
+
+#include "esp_timer.h"
+#include "esp_attr.h"
+#include "esp_err.h"
+#include "esp_log.h"
+
+
+#define SAMPLER_SCAN_LEN_MAX 8  // size of the SAR1 pattern table used for the scan
+
+
+typedef struct sampler_frame {
+    uint32_t seq;  // frame number since the start
+    int64_t timestamp_us;  // esp_timer time of the newest conversion averaged into the frame
+    uint8_t channel_mask;  // bit per ADC1 channel present in the frame
+    float values[ADC1_CHANNEL_MAX];  // averaged raw readings, indexed by the ADC1 channel
+} sampler_frame_t;
+
+typedef struct sampler_stats {
+    uint32_t frames;
+    uint32_t conversions;
+    uint32_t foreign_conversions;  // words tagged with a channel outside of the scan list (should stay 0)
+} sampler_stats_t;
+
+
+esp_err_t sampler_start(const adc1_channel_t *scan_list, int scan_len, adc_atten_t atten);
+
+bool sampler_get_frame(sampler_frame_t *frame);
+bool sampler_get_value(adc1_channel_t channel, float *value, int64_t *timestamp_us);
+bool sampler_is_scanned(adc1_channel_t channel);
+void sampler_get_stats(sampler_stats_t *stats);
+
+
+#endif /* sampler_h */
@@ -0,0 +1,232 @@
+//
+//  sampler.c
+//  pid-controller-server
+//
+//  Continuous ADC1 sampling: the converter is driven through I2S DMA over a scan list of channels, conversions are
+//  oversampled and decimated into averaged, timestamped frames consumers can read without any driver calls
+//
+
+#include "sampler.h"
+
+
+#define SAMPLER_I2S_PORT I2S_NUM_0  // only I2S0 can be fed by the built-in ADC
+#define SAMPLER_DMA_BUF_COUNT 2  // ping-pong: one buffer is filled by the DMA while the other one is processed
+#define SAMPLER_TASK_PRIORITY 11  // above _control_task, it only has a short burst of work per DMA buffer
+#define SAMPLER_TASK_STACK_SIZE 4096
+
+// every 16-bit DMA word carries the channel number on top of the 12-bit conversion result
+#define SAMPLER_WORD_CHANNEL(word) (((word) >> 12) & 0xF)
+#define SAMPLER_WORD_DATA(word) ((word) & 0xFFF)
+
+
+static const char *tag_sampler = "sampler";
+
+
+static uint8_t scan_mask = 0;
+
+/*
+ *  Ping-pong output frames. The newest frame is in frame_slots[frames_published & 1] and the writer always fills the
+ *  other one, so readers practically never collide with it; each slot still has its own sequence (odd while being
+ *  written) to detect the rare case of a reader being overtaken by two whole frames
+ */
+typedef struct frame_slot {
+    uint32_t lock_seq;
+    sampler_frame_t frame;
+} frame_slot_t;
+
+static frame_slot_t frame_slots[2];
+static uint32_t frames_published = 0;
+
+static sampler_stats_t stats;
+
+
+/*
+ *  Program the SAR1 pattern table (what the I2S DMA mode scans through) with the whole list of channels. Each 8-bit
+ *  entry is channel:4 | width:2 | attenuation:2, four entries per register starting from the most significant byte
+ */
+static void _set_scan_pattern(const adc1_channel_t *scan_list, int scan_len, adc_atten_t atten) {
+    for (int i = 0; i < scan_len; i++) {
+        int const tab_idx = i / 4;
+        int const bit_shift = (3 - (i % 4)) * 8;
+        uint32_t const tab_value = ((scan_list[i] & 0xF) << 4) | ((ADC_WIDTH_BIT_12 & 0x3) << 2) | (atten & 0x3);
+        SYSCON.saradc_sar1_patt_tab[tab_idx] = (SYSCON.saradc_sar1_patt_tab[tab_idx] & ~(0xFFu << bit_shift)) |
+                                               (tab_value << bit_shift);
+    }
+    SYSCON.saradc_ctrl.sar1_patt_len = scan_len - 1;
+}
+
+
+static void _publish(const uint32_t *sums, const uint32_t *counts, int64_t timestamp_us) {
+    uint32_t const seq = frames_published + 1;
+    frame_slot_t *slot = &frame_slots[seq & 1];
+
+    __atomic_store_n(&slot->lock_seq, slot->lock_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->frame.seq = seq;
+    slot->frame.timestamp_us = timestamp_us;
+    slot->frame.channel_mask = scan_mask;
+    for (int ch = 0; ch < ADC1_CHANNEL_MAX; ch++) {
+        slot->frame.values[ch] = (counts[ch] != 0) ? ((float)sums[ch] / counts[ch]) : 0.0f;
+    }
+
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&slot->lock_seq, slot->lock_seq + 1, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&frames_published, seq, __ATOMIC_RELEASE);
+    stats.frames++;
+}
+
+
+static void _sampler_task(void *data) {
+
+    uint16_t dma_buf[CONFIG_SAMPLER_DMA_BUF_LEN];
+    uint32_t sums[ADC1_CHANNEL_MAX];
+    uint32_t counts[ADC1_CHANNEL_MAX];
+    uint8_t complete_mask = 0;
+    float const word_period_us = 1000000.0f / CONFIG_SAMPLER_RATE_HZ;
+
+    memset(sums, 0, sizeof(sums));
+    memset(counts, 0, sizeof(counts));
+
+    ESP_LOGI(tag_sampler, "Sampler task started");
+
+    while (1) {
+        size_t bytes_read = 0;
+        i2s_read(SAMPLER_I2S_PORT, dma_buf, sizeof(dma_buf), &bytes_read, portMAX_DELAY);
+        int64_t const block_end_us = esp_timer_get_time();  // the DMA buffer has just been completed
+
+        int const words = bytes_read / sizeof(uint16_t);
+        for (int i = 0; i < words; i++) {
+            unsigned const ch = SAMPLER_WORD_CHANNEL(dma_buf[i]);
+            if ((ch >= ADC1_CHANNEL_MAX) || !(scan_mask & (1 << ch))) {
+                stats.foreign_conversions++;
+                continue;
+            }
+
+            sums[ch] += SAMPLER_WORD_DATA(dma_buf[i]);
+            if (++counts[ch] >= CONFIG_SAMPLER_OVERSAMPLE) {
+                complete_mask |= 1 << ch;
+                // decimate: one frame once every scanned channel has got its share of conversions
+                if (complete_mask == scan_mask) {
+                    _publish(sums, counts, block_end_us - (int64_t)((words - 1 - i) * word_period_us));
+                    memset(sums, 0, sizeof(sums));
+                    memset(counts, 0, sizeof(counts));
+                    complete_mask = 0;
+                }
+            }
+        }
+        stats.conversions += words;
+    }
+}
+
+
+/*
+ *  Start continuous conversions of the given ADC1 channels, CONFIG_SAMPLER_RATE_HZ conversions per second in total.
+ *  Each CONFIG_SAMPLER_OVERSAMPLE conversions of every channel are averaged into one frame
+ */
+esp_err_t sampler_start(const adc1_channel_t *scan_list, int scan_len, adc_atten_t atten) {
+
+    if ((scan_len < 1) || (scan_len > SAMPLER_SCAN_LEN_MAX)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    scan_mask = 0;
+    for (int i = 0; i < scan_len; i++) {
+        if (scan_list[i] >= ADC1_CHANNEL_MAX) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        scan_mask |= 1 << scan_list[i];
+        adc1_config_channel_atten(scan_list[i], atten);  // also routes the pad to the ADC
+    }
+
+    i2s_config_t const i2s_config = {
+        .mode = I2S_MODE_MASTER | I2S_MODE_RX | I2S_MODE_ADC_BUILT_IN,
+        .sample_rate = CONFIG_SAMPLER_RATE_HZ,
+        .bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT,
+        .channel_format = I2S_CHANNEL_FMT_ONLY_RIGHT,
+        .communication_format = I2S_COMM_FORMAT_I2S_MSB,
+        .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1,
+        .dma_buf_count = SAMPLER_DMA_BUF_COUNT,
+        .dma_buf_len = CONFIG_SAMPLER_DMA_BUF_LEN,
+        .use_apll = false
+    };
+    esp_err_t err = i2s_driver_install(SAMPLER_I2S_PORT, &i2s_config, 0, NULL);
+    if (err != ESP_OK) {
+        ESP_LOGE(tag_sampler, "Unable to install I2S driver: %d", err);
+        return err;
+    }
+    i2s_set_adc_mode(ADC_UNIT_1, scan_list[0]);
+    i2s_adc_enable(SAMPLER_I2S_PORT);
+    // the driver has configured a single-channel pattern while enabling, extend it to the whole scan list
+    _set_scan_pattern(scan_list, scan_len, atten);
+
+    xTaskCreatePinnedToCore(_sampler_task, "_sampler_task", SAMPLER_TASK_STACK_SIZE, NULL, SAMPLER_TASK_PRIORITY,
+                            NULL, APP_CPU_NUM);
+
+    ESP_LOGI(tag_sampler, "%d channel(s), %d conversions/s, oversampling %d, %d-word DMA buffers", scan_len,
+             CONFIG_SAMPLER_RATE_HZ, CONFIG_SAMPLER_OVERSAMPLE, CONFIG_SAMPLER_DMA_BUF_LEN);
+    return ESP_OK;
+}
+
+
+/*
+ *  Copy the newest frame. Returns false if no frame has been produced yet
+ */
+bool IRAM_ATTR sampler_get_frame(sampler_frame_t *frame) {
+    while (1) {
+        uint32_t const published = __atomic_load_n(&frames_published, __ATOMIC_ACQUIRE);
+        if (published == 0) {
+            return false;
+        }
+
+        frame_slot_t const *slot = &frame_slots[published & 1];
+        uint32_t const lock_seq = __atomic_load_n(&slot->lock_seq, __ATOMIC_ACQUIRE);
+        if (lock_seq & 1) {
+            continue;
+        }
+        *frame = slot->frame;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->lock_seq, __ATOMIC_RELAXED) == lock_seq) {
+            return true;
+        }
+    }
+}
+
+/*
+ *  Newest averaged value of a single channel (and optionally its timestamp), the control loop hot path. The outputs
+ *  are left untouched if no frame has been produced yet
+ */
+bool IRAM_ATTR sampler_get_value(adc1_channel_t channel, float *value, int64_t *timestamp_us) {
+    while (1) {
+        uint32_t const published = __atomic_load_n(&frames_published, __ATOMIC_ACQUIRE);
+        if (published == 0) {
+            return false;
+        }
+
+        frame_slot_t const *slot = &frame_slots[published & 1];
+        uint32_t const lock_seq = __atomic_load_n(&slot->lock_seq, __ATOMIC_ACQUIRE);
+        if (lock_seq & 1) {
+            continue;
+        }
+        float const frame_value = slot->frame.values[channel];
+        int64_t const frame_timestamp_us = slot->frame.timestamp_us;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->lock_seq, __ATOMIC_RELAXED) == lock_seq) {
+            *value = frame_value;
+            if (timestamp_us != NULL) {
+                *timestamp_us = frame_timestamp_us;
+            }
+            return true;
+        }
+    }
+}
+
+// whether the channel is in the scan list, any other one never gets a value
+bool sampler_is_scanned(adc1_channel_t channel) {
+    return (channel >= 0) && (channel < ADC1_CHANNEL_MAX) && (scan_mask & (1 << channel));
+}
+
+
+void sampler_get_stats(sampler_stats_t *stats_out) {
+    memcpy(stats_out, &stats, sizeof(sampler_stats_t));
+}
@@ -0,0 +1,220 @@
+//
+//  stream.h
+//  pid-controller-server
+//
+//  Stream of the control loop's signals to the subscribed clients. There is no task of its own: the server loop calls
+//  stream_service() which sends whatever is due and tells when to call it again
+//
+
+#ifndef stream_h
+#define stream_h
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/param.h>  // for MIN()
+
+#include "esp_timer.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+#include "lwip/sockets.h"
+
+#include "controlloop.h"
+#include "sampler.h"
+
+
+/*
+ *  Points are taken by the server loop, which sleeps with 1 ms resolution, so their rate is limited to
+ *  STREAM_RATE_HZ_MAX (and the control loop rate). The exception is a batched stream at the control loop rate itself:
+ *  its points are whole runs of the control loop's ring and the loop only wakes up once per datagram
+ */
+#define STREAM_RATE_HZ_DEFAULT 50
+#define STREAM_RATE_HZ_MAX 1000
+
+/*
+ *  Subscription table. Every client is known by its address and holds a lease renewed by each of its requests: once
+ *  it has been silent for STREAM_LEASE_MS its stream is stopped and its settings are forgotten
+ */
+#define STREAM_CLIENTS_MAX 8
+#define STREAM_LEASE_MS 15000
+
+/*
+ *  Backpressure. Stream datagrams never wait for the network: when one can't be sent (the lwIP buffers are full) it is
+ *  kept and retried later, and each failure halves the group's rate, down to 1/2^STREAM_THROTTLE_MAX of the chosen one,
+ *  which is regained step by step after every STREAM_THROTTLE_RECOVER datagrams sent (full-rate streams keep their
+ *  rate and only wait longer for the retry). Points that don't fit into the backlog meanwhile are dropped, the oldest
+ *  first
+ */
+#define STREAM_THROTTLE_MAX 5
+#define STREAM_THROTTLE_RECOVER 4
+
+/*
+ *  Send-on-delta (stream_config_t.deadband): a point is only sent once one of its fields has moved more than the
+ *  deadband from the point sent last, or when the heartbeat is due even if nothing has changed
+ */
+#define STREAM_HEARTBEAT_MS_DEFAULT 1000
+
+/*
+ *  Largest stream datagram: a UDP payload that fits the 1500-byte Ethernet/Wi-Fi MTU with either an IPv4 or an IPv6
+ *  header, so batches are never fragmented
+ */
+#define STREAM_DATAGRAM_SIZE_MAX (1500-40-8)
+
+
+/*
+ *  First byte of every stream datagram. The low 2 bits are reserved (always zero) in the responses and 0b10 in the
+ *  protocol v2 magic, so the client can tell stream datagrams apart by them. Bits 2-3 hold the STREAM_ENCODING_* of the
+ *  points (zero for the original floats) and bit 4 tells the points are stamped (STREAM_FLAG_STAMPS)
+ */
+#define STREAM_PREFIX 0b00000001  // single point: process variable and controller output
+#define STREAM_BATCH_PREFIX 0b00000011  // stream_batch_header_t followed by 'count' points
+#define STREAM_PREFIX_ENCODING_SHIFT 2
+#define STREAM_PREFIX_STAMPED 0b00010000
+
+enum {
+    STREAM_FRAMING_SINGLE,  // one datagram per point, the original format
+    STREAM_FRAMING_BATCH,  // many points per datagram
+    STREAM_FRAMING_COUNT
+};
+
+enum {
+    STREAM_DEST_UNICAST,  // to the client itself
+    STREAM_DEST_MULTICAST,  // to the CONFIG_STREAM_MULTICAST_ADDR group, shared by every viewer
+    STREAM_DEST_COUNT
+};
+
+/*
+ *  Signals a point can carry (stream_config_t.fields), always in this order. The default is the process variable and
+ *  the controller output, the original points. The controller's terms (see controlloop_terms_t) are those of the
+ *  newest control step of the point, they are never averaged
+ */
+enum {
+    STREAM_FIELD_PV,  // process variable
+    STREAM_FIELD_OUTPUT,  // controller output
+    STREAM_FIELD_SETPOINT,
+    STREAM_FIELD_ERR_P,
+    STREAM_FIELD_ERR_I,
+    STREAM_FIELD_ERR_D,
+    STREAM_FIELD_COUNT
+};
+
+#define STREAM_FIELDS_DEFAULT ((1 << STREAM_FIELD_PV) | (1 << STREAM_FIELD_OUTPUT))
+#define STREAM_FIELDS_ALL ((1 << STREAM_FIELD_COUNT) - 1)
+#define STREAM_FIELDS_RAW (STREAM_FIELDS_DEFAULT | (1 << STREAM_FIELD_SETPOINT))  // on the ADC scale
+
+/*
+ *  How the fields of a point are encoded. The 12-bit ones carry the values rounded to ADC counts, so they only take the
+ *  STREAM_FIELDS_RAW: the process variable and the controller output (as applied to the DAC) are always in the 0..4095
+ *  range, a setpoint outside of it is clamped. A delta is taken from the previous point of the same datagram (the first
+ *  one from zero), so every datagram can be decoded on its own
+ */
+enum {
+    STREAM_ENCODING_FLOAT,  // 4 bytes per field: little-endian floats
+    STREAM_ENCODING_PACKED12,  // each pair of fields is the 24-bit little-endian word first | second << 12, an odd
+                               // last one is a 16-bit word (3 bytes for the default fields)
+    STREAM_ENCODING_DELTA,  // 1-2 bytes per field: its delta zigzag-mapped ((d << 1) ^ (d >> 31)) as a LEB128 varint
+    STREAM_ENCODING_COUNT
+};
+
+#define STREAM_ENCODING_RAW_MAX 4095
+
+enum {
+    STREAM_FILTER_AVERAGE,  // every point is the average of the control steps since the previous one (decimation)
+    STREAM_FILTER_LATEST,  // every point is the last step's values, as they were originally streamed
+    STREAM_FILTER_COUNT
+};
+
+/*
+ *  Stream settings as exchanged with the client (VAR_stream_config, CMD_stream_start write). All-zero is the original
+ *  format and rate and every field added later must keep it that way, so shorter (older or zero-padded) payloads stay
+ *  valid
+ */
+typedef struct stream_config {
+    uint8_t framing;  // STREAM_FRAMING_*
+    uint8_t samples_per_packet;  // batch: send as soon as this many points are collected, 0 is as many as fit
+    uint16_t flush_ms;  // batch: send an incomplete batch once its first point is this old, 0 only sends full ones
+    uint16_t rate_hz;  // points per second (see STREAM_RATE_HZ_MAX), 0 is STREAM_RATE_HZ_DEFAULT
+    uint8_t filter;  // STREAM_FILTER_*
+    uint8_t destination;  // STREAM_DEST_*, multicast needs CONFIG_STREAM_MULTICAST
+    uint8_t encoding;  // STREAM_ENCODING_*
+    uint8_t flags;  // STREAM_FLAG_*
+    uint8_t fields;  // mask of 1 << STREAM_FIELD_*, 0 is STREAM_FIELDS_DEFAULT
+    float deadband;  // send-on-delta, 0 sends every point; not at the full rate, a batch needs STREAM_FLAG_STAMPS
+    uint16_t heartbeat_ms;  // send-on-delta: longest silence, 0 is STREAM_HEARTBEAT_MS_DEFAULT
+} __attribute__((packed)) stream_config_t;
+
+/*
+ *  Every point carries its sequence number and the esp_timer time of the newest control step it holds: a single point
+ *  is preceded by stream_point_header_t, in a batch (whose header has the first ones) each point is preceded by how
+ *  far its time is from the nominal one, timestamp_us + i*period_us, as a zigzag varint in microseconds
+ */
+#define STREAM_FLAG_STAMPS 0x01
+#define STREAM_FLAGS_ALL STREAM_FLAG_STAMPS
+
+typedef struct stream_batch_header {
+    uint8_t prefix;  // STREAM_BATCH_PREFIX
+    uint8_t count;  // number of points that follow
+    uint16_t _reserved;
+    uint32_t seq;  // index of the first point since the stream start, a gap means lost datagrams
+    uint32_t timestamp_us;  // esp_timer time of the first point (lower 32 bits)
+    uint32_t period_us;  // the next points follow at this interval
+} __attribute__((packed)) stream_batch_header_t;
+
+typedef struct stream_point_header {
+    uint8_t prefix;  // STREAM_PREFIX | STREAM_PREFIX_STAMPED
+    uint32_t seq;  // index of the point since the stream start
+    uint32_t timestamp_us;  // esp_timer time of the point (lower 32 bits)
+} __attribute__((packed)) stream_point_header_t;
+
+typedef struct stream_stats {
+    uint32_t points;  // sent by all the streams
+    uint32_t datagrams;  // encoded (a datagram for many clients is counted once)
+    uint32_t ring_overruns;  // control steps lost by the full-rate streams falling behind the control loop's ring
+    uint32_t send_errors;  // datagrams the network refused (counted for each destination)
+    uint32_t points_dropped;  // never sent because of the backpressure (ring overruns included)
+    uint32_t throttles;  // times a stream's rate has been halved
+    uint32_t points_unchanged;  // taken but not sent by the send-on-delta streams
+} stream_stats_t;
+
+/*
+ *  Delivery of a client's stream since its start, judged by the sequence numbers of the points it has been sent: any
+ *  point missing from that sequence (dropped, overrun or not taken by the network) is lost for the client, and so are
+ *  the points of a full-rate datagram the control loop has overwritten while it was being sent (the client gets them,
+ *  possibly mixed with newer values)
+ */
+typedef struct stream_session_stats {
+    uint32_t duration_ms;
+    uint32_t points;  // sent to the client
+    uint32_t datagrams;
+    uint32_t points_lost;
+    uint32_t gaps;  // breaks in the sequence and overwritten datagrams
+} stream_session_stats_t;
+
+/*
+ *  A batch holds at most as many points as fit in it as floats (the largest encoding), each one after the largest
+ *  stamp if stamped, and no more than its 8-bit count: 179 of the default points, 110 stamped
+ */
+#define STREAM_POINT_SIZE (2*sizeof(float))  // of the default fields as floats
+#define STREAM_POINT_SIZE_MAX (STREAM_FIELD_COUNT*sizeof(float))
+#define STREAM_STAMP_SIZE_MAX 5  // a 32-bit varint
+#define STREAM_BATCH_SAMPLES_MAX UINT8_MAX
+
+
+void stream_touch(const struct sockaddr *addr);
+
+esp_err_t stream_set_config(const struct sockaddr *addr, socklen_t addr_len, const stream_config_t *new_config);
+void stream_get_config(const struct sockaddr *addr, stream_config_t *config_out);
+
+esp_err_t stream_start(const struct sockaddr *addr, socklen_t addr_len);
+void stream_stop(const struct sockaddr *addr);
+int64_t stream_service(int sock, int64_t now_us);
+
+void stream_get_stats(stream_stats_t *stats_out);
+void stream_get_session(const struct sockaddr *addr, stream_session_stats_t *session_out);
+
+
+#endif /* stream_h */
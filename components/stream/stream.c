@@ -0,0 +1,1082 @@
+//
+//  stream.c
+//  pid-controller-server
+//
+//  Stream of the control loop's signals to the subscribed clients. There is no task of its own: the server loop calls
+//  stream_service() which sends whatever is due and tells when to call it again
+//
+
+#include "stream.h"
+
+
+#define STREAM_CLIENT_SLOTS (2*STREAM_CLIENTS_MAX)  // the hash table is kept at most half full
+#define STREAM_CLIENT_SLOTS_MASK (STREAM_CLIENT_SLOTS - 1)
+
+_Static_assert((STREAM_CLIENT_SLOTS & STREAM_CLIENT_SLOTS_MASK) == 0, "STREAM_CLIENTS_MAX must be a power of 2");
+_Static_assert(sizeof(controlloop_point_t) == STREAM_POINT_SIZE, "ring slots are sent as stream points");
+
+// full-rate streams keep this many steps away from the slots the control loop is about to overwrite
+#define STREAM_RING_MARGIN 16
+
+
+static const char *tag_stream = "stream";
+
+
+/*
+ *  Clients are found by their address through an open-addressing hash table (linear probing), so a request costs a
+ *  hash and usually a single comparison no matter how many clients there are
+ */
+typedef struct stream_client {
+    bool used;
+    int8_t group;  // index of the stream group, -1 while not streaming
+    socklen_t addr_len;
+    struct sockaddr_in6 addr;  // large enough for both IPv4 and IPv6
+    int64_t lease_end_us;
+    stream_config_t config;
+
+    // the stream session: what the client has been sent, judged by the points' sequence numbers
+    stream_session_stats_t session;
+    int64_t session_start_us;
+    bool seq_known;  // false until the first datagram (of the session or of a new group)
+    uint32_t seq_next;  // index of the point expected next
+} stream_client_t;
+
+/*
+ *  What the points of a stream are made of, worked out once from its settings: the fields in the order they are sent
+ *  and the room they take
+ */
+typedef struct stream_layout {
+    int field_cnt;
+    uint8_t field[STREAM_FIELD_COUNT];  // STREAM_FIELD_*
+    int point_size;  // as floats, the way the points are collected
+    int samples_max;  // points a batch can hold
+    bool ring_direct;  // the ring slots are the points as they are sent: default fields, floats, no stamps
+} stream_layout_t;
+
+/*
+ *  Clients streaming with the same settings share a group, which takes and encodes every point once and sends the
+ *  result to each of its members
+ */
+typedef struct stream_group {
+    int members;  // 0 is a free group
+    stream_config_t config;
+    stream_layout_t layout;
+    int32_t period_base_us;  // of the chosen rate
+    int32_t period_us;  // of the points being taken, longer while throttled
+    int64_t next_us;  // when the next point is due
+    controlloop_totals_t totals_prev;  // where the previous point's average has ended
+    uint32_t seq;  // index of the next point
+
+    // backpressure: the rate is halved 'throttle' times and after a failed datagram nothing is sent before 'retry_us'
+    int throttle;
+    int sent_ok;  // datagrams sent since 'throttle' has last changed
+    int64_t retry_us;
+
+    // send-on-delta: the fields of the point sent last and when the next one is due anyway
+    float reported[STREAM_FIELD_COUNT];
+    int64_t heartbeat_us;
+
+    // full rate: the points are the steps of the control loop's ring from 'ring_cursor' on, sent right from the ring
+    bool raw;
+    uint32_t ring_start;
+    uint32_t ring_cursor;
+
+    // batch being collected: the header is filled in by the first point, the datagram is sent once it has
+    // 'batch_capacity' points or its flush deadline has passed
+    int batch_count;
+    int batch_capacity;
+    int64_t batch_flush_us;
+    uint32_t batch_first;  // full rate: ring step of the first point (the batch is sent straight from the ring)
+    unsigned char batch_buf[STREAM_DATAGRAM_SIZE_MAX];
+    uint32_t batch_times[STREAM_BATCH_SAMPLES_MAX];  // of the points collected (the ring has its own)
+} stream_group_t;
+
+
+static stream_client_t clients[STREAM_CLIENT_SLOTS];
+static int clients_cnt = 0;
+static int streaming_cnt = 0;
+
+static stream_group_t groups[STREAM_CLIENTS_MAX];
+
+static stream_stats_t stats;
+
+// a datagram in a compact encoding is put together here just before it is sent
+static unsigned char encode_buf[STREAM_DATAGRAM_SIZE_MAX];
+
+#if CONFIG_STREAM_MULTICAST
+static int mcast_sock = -1;
+static struct sockaddr_in6 mcast_addr;  // large enough for both IPv4 and IPv6
+static socklen_t mcast_addr_len = 0;
+#endif
+
+
+static uint32_t _fnv1a(uint32_t hash, const void *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ ((const uint8_t *)data)[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static unsigned _addr_slot(const struct sockaddr *addr) {
+    uint32_t hash = 2166136261u;
+    if (addr->sa_family == AF_INET6) {
+        struct sockaddr_in6 const *addr6 = (const struct sockaddr_in6 *)addr;
+        hash = _fnv1a(hash, &addr6->sin6_addr, sizeof(addr6->sin6_addr));
+        hash = _fnv1a(hash, &addr6->sin6_port, sizeof(addr6->sin6_port));
+    }
+    else {
+        struct sockaddr_in const *addr4 = (const struct sockaddr_in *)addr;
+        hash = _fnv1a(hash, &addr4->sin_addr, sizeof(addr4->sin_addr));
+        hash = _fnv1a(hash, &addr4->sin_port, sizeof(addr4->sin_port));
+    }
+    return hash & STREAM_CLIENT_SLOTS_MASK;
+}
+
+static bool _addr_equal(const struct sockaddr *a, const struct sockaddr *b) {
+    if (a->sa_family != b->sa_family) {
+        return false;
+    }
+    if (a->sa_family == AF_INET6) {
+        struct sockaddr_in6 const *a6 = (const struct sockaddr_in6 *)a;
+        struct sockaddr_in6 const *b6 = (const struct sockaddr_in6 *)b;
+        return (a6->sin6_port == b6->sin6_port) && !memcmp(&a6->sin6_addr, &b6->sin6_addr, sizeof(a6->sin6_addr));
+    }
+    struct sockaddr_in const *a4 = (const struct sockaddr_in *)a;
+    struct sockaddr_in const *b4 = (const struct sockaddr_in *)b;
+    return (a4->sin_port == b4->sin_port) && (a4->sin_addr.s_addr == b4->sin_addr.s_addr);
+}
+
+
+static stream_client_t *_client_find(const struct sockaddr *addr) {
+    for (unsigned i = _addr_slot(addr); clients[i].used; i = (i + 1) & STREAM_CLIENT_SLOTS_MASK) {
+        if (_addr_equal((const struct sockaddr *)&clients[i].addr, addr)) {
+            return &clients[i];
+        }
+    }
+    return NULL;
+}
+
+// find the client or make a new entry (with the default settings) for it, NULL if the table is full
+static stream_client_t *_client_get(const struct sockaddr *addr, socklen_t addr_len) {
+    stream_client_t *client = _client_find(addr);
+    if ((client != NULL) || (clients_cnt >= STREAM_CLIENTS_MAX) || (addr_len > sizeof(client->addr))) {
+        return client;
+    }
+
+    unsigned i = _addr_slot(addr);
+    while (clients[i].used) {
+        i = (i + 1) & STREAM_CLIENT_SLOTS_MASK;
+    }
+    client = &clients[i];
+    memset(client, 0, sizeof(stream_client_t));
+    client->used = true;
+    client->group = -1;
+    client->addr_len = addr_len;
+    memcpy(&client->addr, addr, addr_len);
+    client->lease_end_us = esp_timer_get_time() + STREAM_LEASE_MS*1000;
+    clients_cnt++;
+    return client;
+}
+
+/*
+ *  Free the slot and move the following entries of the probe sequence back so lookups never stop at a hole
+ */
+static void _client_remove(stream_client_t *client) {
+    unsigned hole = client - clients;
+    clients[hole].used = false;
+    clients_cnt--;
+
+    for (unsigned i = (hole + 1) & STREAM_CLIENT_SLOTS_MASK; clients[i].used; i = (i + 1) & STREAM_CLIENT_SLOTS_MASK) {
+        unsigned const home = _addr_slot((const struct sockaddr *)&clients[i].addr);
+        // the entry can fill the hole unless its home slot lies cyclically in (hole, i]
+        if (((i - home) & STREAM_CLIENT_SLOTS_MASK) >= ((i - hole) & STREAM_CLIENT_SLOTS_MASK)) {
+            clients[hole] = clients[i];
+            clients[i].used = false;
+            hole = i;
+        }
+    }
+}
+
+
+#if CONFIG_STREAM_MULTICAST
+/*
+ *  Open the publishing socket on the first multicast subscription. Its family is the one of the configured group,
+ *  whatever the server socket is. Neither family picks the egress interface (IP_MULTICAST_IF, IPV6_MULTICAST_IF), the
+ *  routing table does: the station is the only interface the server brings up
+ */
+static esp_err_t _mcast_open(void) {
+    if (mcast_sock >= 0) {
+        return ESP_OK;
+    }
+
+    memset(&mcast_addr, 0, sizeof(mcast_addr));
+    struct sockaddr_in *addr4 = (struct sockaddr_in *)&mcast_addr;
+    if (inet_pton(AF_INET, CONFIG_STREAM_MULTICAST_ADDR, &addr4->sin_addr) == 1) {
+        addr4->sin_family = AF_INET;
+        addr4->sin_port = htons(CONFIG_STREAM_MULTICAST_PORT);
+        mcast_addr_len = sizeof(struct sockaddr_in);
+    }
+    else if (inet_pton(AF_INET6, CONFIG_STREAM_MULTICAST_ADDR, &mcast_addr.sin6_addr) == 1) {
+        mcast_addr.sin6_family = AF_INET6;
+        mcast_addr.sin6_port = htons(CONFIG_STREAM_MULTICAST_PORT);
+        mcast_addr_len = sizeof(struct sockaddr_in6);
+    }
+    else {
+        ESP_LOGE(tag_stream, "Invalid multicast group address %s", CONFIG_STREAM_MULTICAST_ADDR);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    int err;
+    int sock;
+    if (mcast_addr.sin6_family == AF_INET) {
+        sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+        uint8_t const ttl = CONFIG_STREAM_MULTICAST_TTL;  // lwIP only takes a byte
+        err = (sock < 0) ? sock : setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    }
+    else {
+        sock = socket(AF_INET6, SOCK_DGRAM, IPPROTO_IPV6);
+        int const hops = CONFIG_STREAM_MULTICAST_TTL;
+        err = (sock < 0) ? sock : setsockopt(sock, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &hops, sizeof(hops));
+    }
+    if (err < 0) {
+        ESP_LOGE(tag_stream, "Unable to create multicast socket: errno %d", errno);
+        if (sock >= 0) {
+            close(sock);
+        }
+        return ESP_FAIL;
+    }
+
+    mcast_sock = sock;
+    ESP_LOGI(tag_stream, "Multicast streams go to %s port %d", CONFIG_STREAM_MULTICAST_ADDR,
+             CONFIG_STREAM_MULTICAST_PORT);
+    return ESP_OK;
+}
+
+/*
+ *  All the multicast groups would publish to the same address and the viewers couldn't tell their datagrams apart, so
+ *  there is one at a time: another client can only join it with the very same settings. Its only member may change
+ *  them. Checked when a client starts streaming or changes the settings it streams with, stored settings don't count
+ */
+static bool _mcast_conflict(const stream_client_t *client, const stream_config_t *config) {
+    if (config->destination != STREAM_DEST_MULTICAST) {
+        return false;
+    }
+    for (int g = 0; g < STREAM_CLIENTS_MAX; g++) {
+        if ((groups[g].members != 0) && (groups[g].config.destination == STREAM_DEST_MULTICAST) &&
+            memcmp(&groups[g].config, config, sizeof(stream_config_t)) &&
+            !((client != NULL) && (client->group == g) && (groups[g].members == 1))) {
+            return true;
+        }
+    }
+    return false;
+}
+#endif
+
+
+static uint8_t _prefix(const stream_config_t *config, uint8_t prefix) {
+    return prefix | (config->encoding << STREAM_PREFIX_ENCODING_SHIFT) |
+           ((config->flags & STREAM_FLAG_STAMPS) ? STREAM_PREFIX_STAMPED : 0);
+}
+
+// stamped points or a compact encoding have to be encoded, floats can go out as they are
+static bool _needs_encoding(const stream_config_t *config) {
+    return (config->encoding != STREAM_ENCODING_FLOAT) || (config->flags & STREAM_FLAG_STAMPS);
+}
+
+static uint8_t _fields(const stream_config_t *config) {
+    return (config->fields != 0) ? config->fields : STREAM_FIELDS_DEFAULT;
+}
+
+static void _layout_init(const stream_config_t *config, stream_layout_t *layout) {
+    uint8_t const fields = _fields(config);
+    layout->field_cnt = 0;
+    for (int f = 0; f < STREAM_FIELD_COUNT; f++) {
+        if (fields & (1 << f)) {
+            layout->field[layout->field_cnt++] = f;
+        }
+    }
+    layout->point_size = layout->field_cnt*sizeof(float);
+    int const stamp_size = (config->flags & STREAM_FLAG_STAMPS) ? STREAM_STAMP_SIZE_MAX : 0;
+    layout->samples_max = MIN((STREAM_DATAGRAM_SIZE_MAX - sizeof(stream_batch_header_t)) /
+                              (layout->point_size + stamp_size), STREAM_BATCH_SAMPLES_MAX);
+    layout->ring_direct = (fields == STREAM_FIELDS_DEFAULT) && !_needs_encoding(config);
+}
+
+// a throttled batch keeps its duration: fewer points a longer period apart
+static void _batch_reset(stream_group_t *group) {
+    group->batch_count = 0;
+    int const samples_max = group->layout.samples_max;
+    int const capacity = ((group->config.samples_per_packet != 0) && (group->config.samples_per_packet < samples_max)) ?
+                         group->config.samples_per_packet : samples_max;
+    group->batch_capacity = MAX(capacity >> group->throttle, 1);
+}
+
+// the points are collected as they are (floats) and only encoded when the batch is sent
+static void _batch_add(stream_group_t *group, const float *point, uint32_t timestamp_us, int64_t now_us) {
+    if (group->batch_count == 0) {
+        stream_batch_header_t const header = {
+            .prefix = _prefix(&group->config, STREAM_BATCH_PREFIX),
+            .seq = group->seq,
+            .timestamp_us = timestamp_us,
+            .period_us = group->period_us
+        };
+        memcpy(group->batch_buf, &header, sizeof(header));
+        group->batch_flush_us = now_us + group->config.flush_ms*1000;
+    }
+    memcpy(&group->batch_buf[sizeof(stream_batch_header_t) + group->batch_count*group->layout.point_size], point,
+           group->layout.point_size);
+    group->batch_times[group->batch_count] = timestamp_us;
+    group->batch_count++;
+}
+
+// make room for a new point in a batch that couldn't be sent yet: its oldest point is given up
+static void _batch_drop_oldest(stream_group_t *group) {
+    stats.points_dropped++;
+    if (--group->batch_count == 0) {
+        return;  // the next point starts the header afresh
+    }
+    stream_batch_header_t *header = (stream_batch_header_t *)group->batch_buf;
+    header->seq++;
+    header->timestamp_us = group->batch_times[1];
+    unsigned char *points = &group->batch_buf[sizeof(stream_batch_header_t)];
+    memmove(points, points + group->layout.point_size, group->batch_count*group->layout.point_size);
+    memmove(&group->batch_times[0], &group->batch_times[1], group->batch_count*sizeof(uint32_t));
+}
+
+
+/*
+ *  Join the group streaming with these settings or start a new one
+ */
+static int _group_join(const stream_config_t *config) {
+    int free_idx = -1;
+    for (int g = 0; g < STREAM_CLIENTS_MAX; g++) {
+        if (groups[g].members == 0) {
+            if (free_idx < 0) {
+                free_idx = g;
+            }
+        }
+        else if (!memcmp(&groups[g].config, config, sizeof(stream_config_t))) {
+            groups[g].members++;
+            return g;
+        }
+    }
+
+    // there are as many groups as clients, so a free one is always there
+    stream_group_t *group = &groups[free_idx];
+    memset(group, 0, offsetof(stream_group_t, batch_buf));
+    group->members = 1;
+    memcpy(&group->config, config, sizeof(stream_config_t));
+    _layout_init(config, &group->layout);
+    group->period_base_us = 1000000 / ((config->rate_hz != 0) ? config->rate_hz : STREAM_RATE_HZ_DEFAULT);
+    group->period_us = group->period_base_us;
+    group->next_us = esp_timer_get_time();  // the first point goes out right after the reply
+    controlloop_get_totals(&group->totals_prev);
+    group->raw = (config->rate_hz == CONFIG_CONTROL_LOOP_RATE_HZ);
+    group->ring_start = controlloop_ring_head();
+    group->ring_cursor = group->ring_start;
+    _batch_reset(group);
+    return free_idx;
+}
+
+// an incomplete batch of a group nobody is left in is discarded
+static void _group_leave(int g) {
+    groups[g].members--;
+}
+
+static void _client_stream_start(stream_client_t *client) {
+    client->group = _group_join(&client->config);
+    memset(&client->session, 0, sizeof(client->session));
+    client->session_start_us = esp_timer_get_time();
+    client->seq_known = false;
+    streaming_cnt++;
+}
+
+static void _client_stream_stop(stream_client_t *client) {
+    _group_leave(client->group);
+    client->group = -1;
+
+    stream_session_stats_t *session = &client->session;
+    session->duration_ms = (esp_timer_get_time() - client->session_start_us) / 1000;
+    ESP_LOGI(tag_stream, "session: %u points in %u datagrams over %u ms, %u lost in %u gaps", session->points,
+             session->datagrams, session->duration_ms, session->points_lost, session->gaps);
+
+    // report the statistics of the whole session once the last client is gone
+    if (--streaming_cnt == 0) {
+        controlloop_stats_t stats;
+        controlloop_get_stats(&stats, true);
+        ESP_LOGI(tag_stream, "control loop: %u steps, %u overruns, period %d us: avg %.1f, min %d, max %d, "
+                 "jitter max %d, rms %.1f", stats.iterations, stats.overruns, stats.period_nominal_us,
+                 stats.period_avg_us, stats.period_min_us, stats.period_max_us, stats.jitter_max_us,
+                 stats.jitter_rms_us);
+
+        sampler_stats_t sampler_stats;
+        sampler_get_stats(&sampler_stats);
+        ESP_LOGI(tag_stream, "sampler: %u frames, %u conversions, %u foreign", sampler_stats.frames,
+                 sampler_stats.conversions, sampler_stats.foreign_conversions);
+    }
+}
+
+
+/*
+ *  Renew the lease of a known client, called for every datagram it sends
+ */
+void stream_touch(const struct sockaddr *addr) {
+    stream_client_t *client = _client_find(addr);
+    if (client != NULL) {
+        client->lease_end_us = esp_timer_get_time() + STREAM_LEASE_MS*1000;
+    }
+}
+
+
+/*
+ *  Validate and apply the settings of the client. A running stream moves over to the group of the new settings (a
+ *  batch being collected for it alone is discarded)
+ */
+esp_err_t stream_set_config(const struct sockaddr *addr, socklen_t addr_len, const stream_config_t *new_config) {
+    if (new_config->fields & ~STREAM_FIELDS_ALL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    stream_layout_t layout;
+    _layout_init(new_config, &layout);  // of at least one field now
+    bool const full_rate_batch = (new_config->rate_hz == CONFIG_CONTROL_LOOP_RATE_HZ) &&
+                                 (new_config->framing == STREAM_FRAMING_BATCH);
+    if ((new_config->framing >= STREAM_FRAMING_COUNT) || (new_config->samples_per_packet > layout.samples_max) ||
+        (new_config->rate_hz > CONFIG_CONTROL_LOOP_RATE_HZ) ||
+        ((new_config->rate_hz > STREAM_RATE_HZ_MAX) && !full_rate_batch) ||
+        (new_config->filter >= STREAM_FILTER_COUNT) || (new_config->destination >= STREAM_DEST_COUNT) ||
+        (new_config->encoding >= STREAM_ENCODING_COUNT) || (new_config->flags & ~STREAM_FLAGS_ALL) ||
+        ((new_config->encoding != STREAM_ENCODING_FLOAT) && (_fields(new_config) & ~STREAM_FIELDS_RAW))) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // the steps of a full-rate stream go out from the ring as they come, and the points left out of a batch would
+    // break its regular time grid unless they are stamped
+    if ((new_config->deadband != 0.0f) &&
+        (!isfinite(new_config->deadband) || (new_config->deadband < 0.0f) ||
+         (new_config->rate_hz == CONFIG_CONTROL_LOOP_RATE_HZ) ||
+         ((new_config->framing == STREAM_FRAMING_BATCH) && !(new_config->flags & STREAM_FLAG_STAMPS)))) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (new_config->destination == STREAM_DEST_MULTICAST) {
+#if CONFIG_STREAM_MULTICAST
+        if (_mcast_open() != ESP_OK) {
+            return ESP_ERR_NOT_SUPPORTED;
+        }
+        stream_client_t const *member = _client_find(addr);
+        if ((member != NULL) && (member->group >= 0) && _mcast_conflict(member, new_config)) {
+            return ESP_ERR_INVALID_STATE;
+        }
+#else
+        return ESP_ERR_NOT_SUPPORTED;
+#endif
+    }
+    stream_client_t *client = _client_get(addr, addr_len);
+    if (client == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    memcpy(&client->config, new_config, sizeof(stream_config_t));
+    if (client->group >= 0) {
+        _group_leave(client->group);
+        client->group = _group_join(&client->config);
+        client->seq_known = false;  // the points are counted by the new group from now on
+    }
+    return ESP_OK;
+}
+
+// unknown clients get the default settings
+void stream_get_config(const struct sockaddr *addr, stream_config_t *config_out) {
+    stream_client_t const *client = _client_find(addr);
+    if (client != NULL) {
+        memcpy(config_out, &client->config, sizeof(stream_config_t));
+    }
+    else {
+        memset(config_out, 0, sizeof(stream_config_t));
+    }
+}
+
+
+esp_err_t stream_start(const struct sockaddr *addr, socklen_t addr_len) {
+    stream_client_t *client = _client_get(addr, addr_len);
+    if (client == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (client->group < 0) {
+#if CONFIG_STREAM_MULTICAST
+        if (_mcast_conflict(client, &client->config)) {
+            return ESP_ERR_INVALID_STATE;
+        }
+#endif
+        _client_stream_start(client);
+    }
+    return ESP_OK;
+}
+
+// the client stays in the table (with its settings) until its lease ends
+void stream_stop(const struct sockaddr *addr) {
+    stream_client_t *client = _client_find(addr);
+    if ((client != NULL) && (client->group >= 0)) {
+        _client_stream_stop(client);
+    }
+}
+
+
+// every field of a control step from the ring
+static void _ring_values(uint32_t seq, float *values) {
+    controlloop_point_t const *slot = controlloop_ring_slot(seq);
+    controlloop_terms_t const *terms = controlloop_ring_terms(seq);
+    values[STREAM_FIELD_PV] = slot->process_variable;
+    values[STREAM_FIELD_OUTPUT] = slot->controller_output;
+    values[STREAM_FIELD_SETPOINT] = terms->setpoint;
+    values[STREAM_FIELD_ERR_P] = terms->err_P;
+    values[STREAM_FIELD_ERR_I] = terms->err_I;
+    values[STREAM_FIELD_ERR_D] = terms->err_D;
+}
+
+// the fields of the layout, in its order
+static void _gather(const stream_layout_t *layout, const float *values, float *point) {
+    for (int i = 0; i < layout->field_cnt; i++) {
+        point[i] = values[layout->field[i]];
+    }
+}
+
+static void _ring_point(const stream_layout_t *layout, uint32_t seq, float *point) {
+    float values[STREAM_FIELD_COUNT];
+    _ring_values(seq, values);
+    _gather(layout, values, point);
+}
+
+/*
+ *  Fields of the next point: the process variable and the controller output averaged since the previous point (the
+ *  comb stage of the decimator whose integrator is the control loop's totals) or the latest ones, the rest as of the
+ *  latest step (whose ring slot the control loop won't touch for a whole round). Returns the point's timestamp
+ */
+static uint32_t _take_point(stream_group_t *group, float *point) {
+    controlloop_totals_t totals;
+    controlloop_get_totals(&totals);
+    uint32_t const steps = totals.steps - group->totals_prev.steps;
+
+    float values[STREAM_FIELD_COUNT];
+    _ring_values(controlloop_ring_head() - 1, values);
+    if ((group->config.filter == STREAM_FILTER_AVERAGE) && (steps != 0)) {
+        values[STREAM_FIELD_PV] = (float)(int64_t)(totals.pv_sum - group->totals_prev.pv_sum) /
+                                  (steps * CONTROLLOOP_TOTALS_SCALE);
+        values[STREAM_FIELD_OUTPUT] = (float)(int64_t)(totals.out_sum - group->totals_prev.out_sum) /
+                                      (steps * CONTROLLOOP_TOTALS_SCALE);
+    }
+    group->totals_prev = totals;
+    _gather(&group->layout, values, point);
+    return (uint32_t)totals.timestamp_us;  // of the newest step in the point
+}
+
+
+// the value in ADC counts, rounded and clamped to the 12-bit range (a NaN becomes zero)
+static uint32_t _quantize(float value) {
+    if (!(value > 0.0f)) {
+        return 0;
+    }
+    return (value < STREAM_ENCODING_RAW_MAX) ? (uint32_t)(value + 0.5f) : STREAM_ENCODING_RAW_MAX;
+}
+
+static unsigned char *_put_varint(unsigned char *out, uint32_t value) {
+    while (value >= 0x80) {
+        *out++ = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    *out++ = value;
+    return out;
+}
+
+// small magnitudes of either sign get short codes
+static unsigned char *_put_zigzag(unsigned char *out, int32_t value) {
+    return _put_varint(out, ((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+}
+
+/*
+ *  Append the point (the fields of the group's layout) in the group's encoding, returns where the next one goes.
+ *  'prev' is the previous point of the datagram for the delta encoding, zeroed at its start
+ */
+static unsigned char *_encode_point(const stream_group_t *group, const float *point, int32_t *prev,
+                                    unsigned char *out) {
+    int const field_cnt = group->layout.field_cnt;
+    switch (group->config.encoding) {
+    case STREAM_ENCODING_PACKED12:
+        for (int i = 0; i < field_cnt; i += 2) {
+            uint32_t word = _quantize(point[i]);
+            *out++ = word;
+            if (i + 1 < field_cnt) {
+                word |= _quantize(point[i + 1]) << 12;
+                *out++ = word >> 8;
+                *out++ = word >> 16;
+            }
+            else {
+                *out++ = word >> 8;
+            }
+        }
+        return out;
+    case STREAM_ENCODING_DELTA:
+        for (int i = 0; i < field_cnt; i++) {
+            int32_t const value = _quantize(point[i]);
+            out = _put_zigzag(out, value - prev[i]);
+            prev[i] = value;
+        }
+        return out;
+    default:
+        memcpy(out, point, group->layout.point_size);
+        return out + group->layout.point_size;
+    }
+}
+
+/*
+ *  Put a batch that needs encoding together in encode_buf: the header and the points (each one after its stamp),
+ *  taken either from the batch collected or from the run of the ring it refers to. Returns the length of the datagram
+ */
+static size_t _batch_encode(const stream_group_t *group, bool from_ring) {
+    stream_batch_header_t header;
+    memcpy(&header, group->batch_buf, sizeof(header));
+    memcpy(encode_buf, &header, sizeof(header));
+    unsigned char *out = &encode_buf[sizeof(header)];
+    int32_t prev[STREAM_FIELD_COUNT] = { 0 };
+
+    for (int i = 0; i < group->batch_count; i++) {
+        float point[STREAM_FIELD_COUNT];
+        uint32_t timestamp_us;
+        if (from_ring) {
+            _ring_point(&group->layout, group->batch_first + i, point);
+            timestamp_us = controlloop_ring_timestamp(group->batch_first + i);
+        }
+        else {
+            memcpy(point, &group->batch_buf[sizeof(header) + i*group->layout.point_size], group->layout.point_size);
+            timestamp_us = group->batch_times[i];
+        }
+        if (group->config.flags & STREAM_FLAG_STAMPS) {
+            out = _put_zigzag(out, (int32_t)(timestamp_us - (header.timestamp_us + i*header.period_us)));
+        }
+        out = _encode_point(group, point, prev, out);
+    }
+    return out - encode_buf;
+}
+
+// a single-point datagram, returns its length
+static size_t _single_encode(const stream_group_t *group, const float *point, uint32_t seq, uint32_t timestamp_us,
+                             unsigned char *out) {
+    int32_t prev[STREAM_FIELD_COUNT] = { 0 };
+    if (group->config.flags & STREAM_FLAG_STAMPS) {
+        stream_point_header_t const header = {
+            .prefix = _prefix(&group->config, STREAM_PREFIX),
+            .seq = seq,
+            .timestamp_us = timestamp_us
+        };
+        memcpy(out, &header, sizeof(header));
+        return _encode_point(group, point, prev, &out[sizeof(header)]) - out;
+    }
+    out[0] = _prefix(&group->config, STREAM_PREFIX);
+    return _encode_point(group, point, prev, &out[1]) - out;
+}
+
+/*
+ *  Send-on-delta: whether the point is to be sent. It becomes the reference for the next ones even if the network
+ *  refuses it, the heartbeat makes up for it later
+ */
+static bool _report_due(stream_group_t *group, const float *point, int64_t now_us) {
+    if (group->config.deadband == 0.0f) {
+        return true;
+    }
+    bool due = (now_us >= group->heartbeat_us);
+    for (int i = 0; !due && (i < group->layout.field_cnt); i++) {
+        due = (fabsf(point[i] - group->reported[i]) > group->config.deadband);
+    }
+    if (due) {
+        memcpy(group->reported, point, group->layout.point_size);
+        int const heartbeat_ms = (group->config.heartbeat_ms != 0) ? group->config.heartbeat_ms :
+                                                                     STREAM_HEARTBEAT_MS_DEFAULT;
+        group->heartbeat_us = now_us + heartbeat_ms*1000;
+    }
+    return due;
+}
+
+// never waits for the network: a datagram lwIP has no buffers for fails right away (ENOMEM or EAGAIN)
+static bool _sendmsg(int sock, const struct msghdr *msg) {
+    if (sendmsg(sock, msg, MSG_DONTWAIT) < 0) {
+        stats.send_errors++;
+        return false;
+    }
+    return true;
+}
+
+/*
+ *  Account a datagram of 'count' points from 'seq' on for the client's session: a datagram not following the one
+ *  sent before is a gap and the points in between are lost (one that hasn't been sent shows up as the next gap)
+ */
+static void _session_account(stream_client_t *client, uint32_t seq, int count) {
+    stream_session_stats_t *session = &client->session;
+    if (client->seq_known && (seq != client->seq_next)) {
+        session->gaps++;
+        session->points_lost += seq - client->seq_next;
+    }
+    client->seq_known = true;
+    client->seq_next = seq + count;
+    session->points += count;
+    session->datagrams++;
+}
+
+/*
+ *  The control loop has reached the ring slots of a datagram while it was being sent, so its points may be mixed with
+ *  newer ones: the members that have been sent it get them counted as lost instead, as a gap of their own
+ */
+static void _session_overrun(int g, uint32_t seq, int count) {
+    for (int i = 0; i < STREAM_CLIENT_SLOTS; i++) {
+        stream_client_t *client = &clients[i];
+        if (client->used && (client->group == g) && client->seq_known && (client->seq_next == seq + count)) {
+            client->session.points -= count;
+            client->session.points_lost += count;
+            client->session.gaps++;
+        }
+    }
+}
+
+static bool _group_sendmsg(int sock, int g, struct msghdr *msg, uint32_t seq, int count) {
+    bool sent = false;
+#if CONFIG_STREAM_MULTICAST
+    // the settings (destination included) are the same for the whole group: a multicast one sends a single datagram
+    if (groups[g].config.destination == STREAM_DEST_MULTICAST) {
+        msg->msg_name = &mcast_addr;
+        msg->msg_namelen = mcast_addr_len;
+        sent = _sendmsg(mcast_sock, msg);
+        for (int i = 0; sent && (i < STREAM_CLIENT_SLOTS); i++) {
+            if (clients[i].used && (clients[i].group == g)) {
+                _session_account(&clients[i], seq, count);
+            }
+        }
+        return sent;
+    }
+#endif
+    for (int i = 0; i < STREAM_CLIENT_SLOTS; i++) {
+        if (clients[i].used && (clients[i].group == g)) {
+            msg->msg_name = &clients[i].addr;
+            msg->msg_namelen = clients[i].addr_len;
+            if (_sendmsg(sock, msg)) {
+                _session_account(&clients[i], seq, count);
+                sent = true;
+            }
+        }
+    }
+    return sent;
+}
+
+/*
+ *  Send a datagram to every member of the group and adapt its rate. The datagram counts as sent if any destination
+ *  has taken it (the others just miss it); otherwise the caller keeps it for a retry, the rate is halved and the
+ *  retry waits for the new period
+ */
+static bool _group_send(int sock, int g, struct iovec *iov, int iov_cnt, uint32_t seq, int count, int64_t now_us) {
+    stream_group_t *group = &groups[g];
+    struct msghdr msg = {
+        .msg_iov = iov,
+        .msg_iovlen = iov_cnt
+    };
+
+    if (!_group_sendmsg(sock, g, &msg, seq, count)) {
+        if (group->throttle < STREAM_THROTTLE_MAX) {
+            group->throttle++;
+            stats.throttles++;
+        }
+        group->sent_ok = 0;
+        group->retry_us = now_us + ((int64_t)group->period_base_us << group->throttle);
+        return false;
+    }
+
+    stats.datagrams++;
+    if ((group->throttle > 0) && (++group->sent_ok >= STREAM_THROTTLE_RECOVER)) {
+        group->throttle--;
+        group->sent_ok = 0;
+    }
+    return true;
+}
+
+// the batch stays (and keeps collecting points) if it can't be sent yet
+static bool _batch_flush(int sock, int g, int64_t now_us) {
+    stream_group_t *group = &groups[g];
+    if (now_us < group->retry_us) {
+        return false;
+    }
+
+    stream_batch_header_t *header = (stream_batch_header_t *)group->batch_buf;
+    header->count = group->batch_count;
+    struct iovec iov = {
+        .iov_base = group->batch_buf,
+        .iov_len = sizeof(stream_batch_header_t) + group->batch_count*group->layout.point_size
+    };
+    if (_needs_encoding(&group->config)) {
+        iov.iov_base = encode_buf;
+        iov.iov_len = _batch_encode(group, false);
+    }
+    if (!_group_send(sock, g, &iov, 1, header->seq, group->batch_count, now_us)) {
+        return false;
+    }
+    stats.points += group->batch_count;
+    group->batch_count = 0;
+    return true;
+}
+
+/*
+ *  Send a full-rate batch: the header followed by the run of ring slots (two parts if it wraps around), without
+ *  copying the points (any other layout is encoded from the slots instead). If the control loop has reached
+ *  the run meanwhile, the points sent may be mixed with newer ones and are counted as lost. A batch that can't be sent
+ *  yet stays where it is in the ring
+ */
+static bool _batch_flush_raw(int sock, int g, int64_t now_us) {
+    stream_group_t *group = &groups[g];
+    if (now_us < group->retry_us) {
+        return false;
+    }
+
+    stream_batch_header_t *header = (stream_batch_header_t *)group->batch_buf;
+    header->count = group->batch_count;
+
+    uint32_t const first_slot = group->batch_first & (CONFIG_CONTROL_LOOP_RING_LEN - 1);
+    int const first_run = MIN(group->batch_count, CONFIG_CONTROL_LOOP_RING_LEN - (int)first_slot);
+    struct iovec iov[3] = {
+        { .iov_base = group->batch_buf, .iov_len = sizeof(stream_batch_header_t) },
+        { .iov_base = (void *)controlloop_ring_slot(group->batch_first), .iov_len = first_run*STREAM_POINT_SIZE },
+        { .iov_base = (void *)controlloop_ring_slot(group->batch_first + first_run),
+          .iov_len = (group->batch_count - first_run)*STREAM_POINT_SIZE }
+    };
+    int iov_cnt = (group->batch_count > first_run) ? 3 : 2;
+    if (!group->layout.ring_direct) {
+        iov[0].iov_base = encode_buf;
+        iov[0].iov_len = _batch_encode(group, true);
+        iov_cnt = 1;
+    }
+    if (!_group_send(sock, g, iov, iov_cnt, header->seq, group->batch_count, now_us)) {
+        return false;
+    }
+
+    if (!controlloop_ring_valid(group->batch_first)) {
+        stats.ring_overruns += group->batch_count;
+        _session_overrun(g, header->seq, group->batch_count);
+    }
+    stats.points += group->batch_count;
+    group->batch_count = 0;
+    return true;
+}
+
+
+/*
+ *  Full-rate group: take every step the control loop has made since the last call from its ring. Returns the time of
+ *  the group's next deadline: a single-point stream sends each step as it comes, a batched one waits until the batch
+ *  is expected to be full or old enough (but never so long that the ring could run over the steps not sent yet)
+ */
+static int64_t _group_service_raw(int sock, int g, int64_t now_us) {
+    stream_group_t *group = &groups[g];
+    uint32_t const head = controlloop_ring_head();
+
+    // fallen too far behind (a slow loop or the backpressure): the steps about to be overwritten are given up, the
+    // oldest points of a batch waiting to be sent included
+    uint32_t const readable = CONFIG_CONTROL_LOOP_RING_LEN - STREAM_RING_MARGIN;
+    uint32_t const oldest = (group->batch_count != 0) ? group->batch_first : group->ring_cursor;
+    if (head - oldest > readable) {
+        uint32_t const lost = (head - readable) - oldest;
+        stats.ring_overruns += lost;
+        stats.points_dropped += lost;
+        if (lost < (uint32_t)group->batch_count) {
+            stream_batch_header_t *header = (stream_batch_header_t *)group->batch_buf;
+            header->seq += lost;
+            header->timestamp_us = controlloop_ring_timestamp(group->batch_first + lost);
+            group->batch_first += lost;
+            group->batch_count -= lost;
+        }
+        else {
+            group->ring_cursor = head - readable;
+            group->batch_count = 0;
+        }
+    }
+
+    if (group->config.framing == STREAM_FRAMING_SINGLE) {
+        static unsigned char const prefix = STREAM_PREFIX;
+        for (; (group->ring_cursor != head) && (now_us >= group->retry_us); group->ring_cursor++) {
+            struct iovec iov[2] = {
+                { .iov_base = (void *)&prefix, .iov_len = sizeof(prefix) },
+                { .iov_base = (void *)controlloop_ring_slot(group->ring_cursor), .iov_len = STREAM_POINT_SIZE }
+            };
+            uint32_t const seq = group->ring_cursor - group->ring_start;
+            int iov_cnt = 2;
+            if (!group->layout.ring_direct) {
+                float point[STREAM_FIELD_COUNT];
+                _ring_point(&group->layout, group->ring_cursor, point);
+                iov[0].iov_base = encode_buf;
+                iov[0].iov_len = _single_encode(group, point, seq, controlloop_ring_timestamp(group->ring_cursor),
+                                                encode_buf);
+                iov_cnt = 1;
+            }
+            if (!_group_send(sock, g, iov, iov_cnt, seq, 1, now_us)) {
+                break;  // the step stays in the ring for the retry
+            }
+            if (!controlloop_ring_valid(group->ring_cursor)) {
+                stats.ring_overruns++;
+                _session_overrun(g, seq, 1);
+            }
+            stats.points++;
+        }
+        return (group->ring_cursor != head) ? group->retry_us : (now_us + group->period_us);
+    }
+
+    while (group->ring_cursor != head) {
+        if (group->batch_count == 0) {
+            stream_batch_header_t const header = {
+                .prefix = _prefix(&group->config, STREAM_BATCH_PREFIX),
+                .seq = group->ring_cursor - group->ring_start,
+                .timestamp_us = controlloop_ring_timestamp(group->ring_cursor),
+                .period_us = group->period_us
+            };
+            memcpy(group->batch_buf, &header, sizeof(header));
+            group->batch_first = group->ring_cursor;
+            group->batch_flush_us = now_us + group->config.flush_ms*1000;
+        }
+        int const take = MIN(head - group->ring_cursor, (uint32_t)(group->batch_capacity - group->batch_count));
+        group->batch_count += take;
+        group->ring_cursor += take;
+        // a full batch that can't be sent yet holds the run, the steps that follow wait in the ring
+        if ((group->batch_count >= group->batch_capacity) && !_batch_flush_raw(sock, g, now_us)) {
+            break;
+        }
+    }
+
+    if ((group->batch_count >= group->batch_capacity) ||
+        ((group->batch_count != 0) && (group->config.flush_ms != 0) && (now_us >= group->batch_flush_us))) {
+        _batch_flush_raw(sock, g, now_us);
+    }
+
+    if (group->batch_count >= group->batch_capacity) {
+        return group->retry_us;
+    }
+    int64_t wake_us = now_us + (int64_t)MIN(group->batch_capacity - group->batch_count, (int)readable/2) *
+                               group->period_us;
+    if ((group->batch_count != 0) && (group->config.flush_ms != 0)) {
+        wake_us = MIN(wake_us, MAX(group->batch_flush_us, group->retry_us));
+    }
+    return wake_us;
+}
+
+
+/*
+ *  Take the point of the group if it is due and send what is ready: the point itself or a batch that got full or old
+ *  enough. Returns the time of the group's next deadline
+ */
+static int64_t _group_service(int sock, int g, int64_t now_us) {
+    stream_group_t *group = &groups[g];
+
+    if (group->raw) {
+        return _group_service_raw(sock, g, now_us);
+    }
+
+    if (now_us >= group->next_us) {
+        // the rate only changes between datagrams: all the points of a batch are a single period apart
+        if (group->batch_count == 0) {
+            group->period_us = group->period_base_us << group->throttle;
+            _batch_reset(group);
+        }
+
+        float point[STREAM_FIELD_COUNT];
+        uint32_t const timestamp_us = _take_point(group, point);
+
+        if (!_report_due(group, point, now_us)) {
+            stats.points_unchanged++;  // the sequence only counts the points sent, so the client sees no gap
+        }
+        else if (group->config.framing == STREAM_FRAMING_SINGLE) {
+            unsigned char stream_buf[sizeof(stream_point_header_t) + STREAM_POINT_SIZE_MAX];
+            struct iovec iov = {
+                .iov_base = stream_buf,
+                .iov_len = _single_encode(group, point, group->seq, timestamp_us, stream_buf)
+            };
+            // not kept for a retry: the next point is newer anyway
+            if (_group_send(sock, g, &iov, 1, group->seq, 1, now_us)) {
+                stats.points++;
+            }
+            else {
+                stats.points_dropped++;
+            }
+            group->seq++;
+        }
+        else {
+            if (group->batch_count >= group->batch_capacity) {
+                _batch_drop_oldest(group);
+            }
+            _batch_add(group, point, timestamp_us, now_us);
+            group->seq++;
+        }
+
+        // keep the period but don't try to catch up on the points missed while the loop was busy
+        group->next_us += group->period_us;
+        if (group->next_us <= now_us) {
+            group->next_us = now_us + group->period_us;
+        }
+    }
+
+    if ((group->batch_count >= group->batch_capacity) ||
+        ((group->batch_count != 0) && (group->config.flush_ms != 0) && (now_us >= group->batch_flush_us))) {
+        _batch_flush(sock, g, now_us);
+    }
+
+    // a batch left over is retried when it is full or old enough, but not before its retry time
+    if (group->batch_count >= group->batch_capacity) {
+        return MIN(group->next_us, group->retry_us);
+    }
+    if ((group->batch_count != 0) && (group->config.flush_ms != 0)) {
+        return MIN(group->next_us, MAX(group->batch_flush_us, group->retry_us));
+    }
+    return group->next_us;
+}
+
+
+/*
+ *  Expire the leases that have ended and serve every stream group. Returns the time of the nearest deadline (a point,
+ *  a batch flush or a lease end) or -1 when there is none
+ */
+int64_t stream_service(int sock, int64_t now_us) {
+
+    int64_t wake_us = -1;
+
+    for (int i = 0; i < STREAM_CLIENT_SLOTS; ) {
+        stream_client_t *client = &clients[i];
+        if (client->used && (now_us >= client->lease_end_us)) {
+            ESP_LOGI(tag_stream, "No incoming messages from a client within its lease, forget it");
+            if (client->group >= 0) {
+                _client_stream_stop(client);
+            }
+            _client_remove(client);
+            continue;  // another entry may have been moved into this slot
+        }
+        if (client->used && ((wake_us < 0) || (client->lease_end_us < wake_us))) {
+            wake_us = client->lease_end_us;
+        }
+        i++;
+    }
+
+    for (int g = 0; g < STREAM_CLIENTS_MAX; g++) {
+        if (groups[g].members != 0) {
+            int64_t const group_wake_us = _group_service(sock, g, now_us);
+            if ((wake_us < 0) || (group_wake_us < wake_us)) {
+                wake_us = group_wake_us;
+            }
+        }
+    }
+    return wake_us;
+}
+
+
+void stream_get_stats(stream_stats_t *stats_out) {
+    memcpy(stats_out, &stats, sizeof(stream_stats_t));
+}
+
+// the current or the last session of the client, zeros for an unknown one
+void stream_get_session(const struct sockaddr *addr, stream_session_stats_t *session_out) {
+    stream_client_t const *client = _client_find(addr);
+    if (client == NULL) {
+        memset(session_out, 0, sizeof(stream_session_stats_t));
+        return;
+    }
+    memcpy(session_out, &client->session, sizeof(stream_session_stats_t));
+    if (client->group >= 0) {
+        session_out->duration_ms = (esp_timer_get_time() - client->session_start_us) / 1000;
+    }
+}
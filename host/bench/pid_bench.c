@@ -0,0 +1,209 @@
+/*
+ *  PID engine benchmark: cost of PID_Update() per call (cycles where the CPU has a cycle counter, nanoseconds always)
+ *  and its deviation from the float reference, plus the cost of the velocity-form and batch engines and of a gain
+ *  schedule lookup. Built once with the engine selected in sdkconfig (pid_bench) and once with the fixed-point engine
+ *  forced (pid_bench_fixed)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAVE_CYCLES 1
+#endif
+
+#include "pid.h"
+#include "pid_batch.h"
+#include "pid_schedule.h"
+#include "pid_velocity.h"
+
+
+#define BENCH_STEPS 2000000
+#define BENCH_INPUTS 4096  // length of the (cycled) synthetic process variable record
+#define BENCH_BATCH_LOOPS PID_BATCH_MAX
+
+// a well-behaved loop in ADC units: the output stays well inside the Q15 range
+#define BENCH_SETPOINT 2048.0f
+#define BENCH_KP 0.8f
+#define BENCH_KI 0.05f
+#define BENCH_KD 0.2f
+#define BENCH_PERR_LIMIT 2048.0f
+#define BENCH_IERR_LIMIT 20000.0f
+
+
+static volatile float sink;
+static volatile pid_value_t sink_engine;
+
+
+static double _now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+static unsigned long long _cycles(void) {
+#ifdef BENCH_HAVE_CYCLES
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+
+int main(void) {
+
+    // process variable: slow sine around the setpoint with some noise, 12-bit range
+    static float inputs[BENCH_INPUTS];
+    static pid_value_t inputs_engine[BENCH_INPUTS];
+    srand(1);
+    for (int i = 0; i < BENCH_INPUTS; i++) {
+        inputs[i] = roundf(BENCH_SETPOINT + 1500.0f*sinf(2.0f*(float)M_PI*i/BENCH_INPUTS) + (rand() % 64 - 32));
+        inputs_engine[i] = PID_VALUE_FROM_FLOAT(inputs[i]);
+    }
+
+    PIDdata pid;
+    PID_Init(&pid);
+    PID_Coefficients(&pid, BENCH_SETPOINT, BENCH_KP, BENCH_KI, BENCH_KD);
+    PID_SetLimitsPerr(&pid, -BENCH_PERR_LIMIT, BENCH_PERR_LIMIT);
+    PID_SetLimitsIerr(&pid, -BENCH_IERR_LIMIT, BENCH_IERR_LIMIT);
+
+    // float reference: the batch engine's scalar loop computes exactly what the float PID_Update() does
+    static PIDbatch reference;
+    PID_BatchInit(&reference, 1);
+    PID_BatchCoefficients(&reference, 0, BENCH_SETPOINT, BENCH_KP, BENCH_KI, BENCH_KD);
+    PID_BatchSetLimitsPerr(&reference, 0, -BENCH_PERR_LIMIT, BENCH_PERR_LIMIT);
+    PID_BatchSetLimitsIerr(&reference, 0, -BENCH_IERR_LIMIT, BENCH_IERR_LIMIT);
+
+
+    /*
+     *  Accuracy
+     */
+    double err_max = 0.0;
+    double err_sq_sum = 0.0;
+    for (int i = 0; i < BENCH_STEPS; i++) {
+        float reference_output;
+        PID_BatchUpdateScalar(&reference, &inputs[i % BENCH_INPUTS], &reference_output);
+        float const output = PID_VALUE_TO_FLOAT(PID_Update(&pid, inputs_engine[i % BENCH_INPUTS]));
+        double const err = fabs((double)output - reference_output);
+        if (err > err_max) {
+            err_max = err;
+        }
+        err_sq_sum += err * err;
+    }
+
+
+    /*
+     *  Speed of the single-controller engine
+     */
+    PID_Init(&pid);
+    PID_Coefficients(&pid, BENCH_SETPOINT, BENCH_KP, BENCH_KI, BENCH_KD);
+    PID_SetLimitsPerr(&pid, -BENCH_PERR_LIMIT, BENCH_PERR_LIMIT);
+    PID_SetLimitsIerr(&pid, -BENCH_IERR_LIMIT, BENCH_IERR_LIMIT);
+
+    double const t0 = _now_ns();
+    unsigned long long const c0 = _cycles();
+    for (int i = 0; i < BENCH_STEPS; i++) {
+        sink_engine = PID_Update(&pid, inputs_engine[i & (BENCH_INPUTS - 1)]);
+    }
+    unsigned long long const c1 = _cycles();
+    double const t1 = _now_ns();
+
+
+    /*
+     *  Speed of the velocity-form engine
+     */
+    PIDvelocity velocity;
+    PID_VelocityInit(&velocity, 1.0f);
+    PID_VelocityCoefficients(&velocity, BENCH_SETPOINT, BENCH_KP, BENCH_KI, BENCH_KD);
+    PID_VelocitySetLimits(&velocity, 0.0f, 4095.0f);
+
+    double const tv0 = _now_ns();
+    unsigned long long const cv0 = _cycles();
+    for (int i = 0; i < BENCH_STEPS; i++) {
+        sink = PID_VelocityUpdate(&velocity, inputs[i & (BENCH_INPUTS - 1)]);
+    }
+    unsigned long long const cv1 = _cycles();
+    double const tv1 = _now_ns();
+
+
+    /*
+     *  Speed of the gain schedule lookup (full-size table over the 12-bit range)
+     */
+    static float schedule_gains[PID_SCHEDULE_POINTS_MAX * 3];
+    for (int i = 0; i < PID_SCHEDULE_POINTS_MAX * 3; i++) {
+        schedule_gains[i] = BENCH_KP * (1.0f + 0.01f * i);
+    }
+    PIDschedule schedule;
+    PID_ScheduleInit(&schedule);
+    PID_ScheduleSet(&schedule, PID_SCHEDULE_BY_PV, 0.0f, 4095.0f, PID_SCHEDULE_POINTS_MAX, schedule_gains);
+
+    double const ts0 = _now_ns();
+    unsigned long long const cs0 = _cycles();
+    for (int i = 0; i < BENCH_STEPS; i++) {
+        float kP, kI, kD;
+        PID_ScheduleLookup(&schedule, inputs[i & (BENCH_INPUTS - 1)], &kP, &kI, &kD);
+        sink = kP + kI + kD;
+    }
+    unsigned long long const cs1 = _cycles();
+    double const ts1 = _now_ns();
+
+
+    /*
+     *  Speed of the batch engine (float, whichever SIMD path was compiled), per controller
+     */
+    static PIDbatch batch;
+    static float batch_inputs[BENCH_INPUTS + BENCH_BATCH_LOOPS];
+    static float batch_outputs[BENCH_BATCH_LOOPS];
+    PID_BatchInit(&batch, BENCH_BATCH_LOOPS);
+    for (int i = 0; i < BENCH_BATCH_LOOPS; i++) {
+        PID_BatchCoefficients(&batch, i, BENCH_SETPOINT, BENCH_KP, BENCH_KI, BENCH_KD);
+        PID_BatchSetLimitsPerr(&batch, i, -BENCH_PERR_LIMIT, BENCH_PERR_LIMIT);
+        PID_BatchSetLimitsIerr(&batch, i, -BENCH_IERR_LIMIT, BENCH_IERR_LIMIT);
+    }
+    for (int i = 0; i < BENCH_INPUTS + BENCH_BATCH_LOOPS; i++) {
+        batch_inputs[i] = inputs[i % BENCH_INPUTS];
+    }
+
+    int const batch_calls = BENCH_STEPS / BENCH_BATCH_LOOPS;
+    double const tb0 = _now_ns();
+    unsigned long long const cb0 = _cycles();
+    for (int i = 0; i < batch_calls; i++) {
+        PID_BatchUpdate(&batch, &batch_inputs[i & (BENCH_INPUTS - 1)], batch_outputs);
+        sink = batch_outputs[i & (BENCH_BATCH_LOOPS - 1)];
+    }
+    unsigned long long const cb1 = _cycles();
+    double const tb1 = _now_ns();
+
+
+#if CONFIG_PID_FIXED_POINT
+    printf("engine:             fixed-point (Q15 signals, Q16 gains)\n");
+#else
+    printf("engine:             float\n");
+#endif
+    printf("PID_Update:         %.2f ns/update", (t1 - t0) / BENCH_STEPS);
+#ifdef BENCH_HAVE_CYCLES
+    printf(", %.1f cycles/update", (double)(c1 - c0) / BENCH_STEPS);
+#endif
+    printf("\n");
+    printf("error vs float:     max %.6g, rms %.6g (%d steps)\n", err_max, sqrt(err_sq_sum / BENCH_STEPS), BENCH_STEPS);
+    printf("PID_VelocityUpdate: %.2f ns/update", (tv1 - tv0) / BENCH_STEPS);
+#ifdef BENCH_HAVE_CYCLES
+    printf(", %.1f cycles/update", (double)(cv1 - cv0) / BENCH_STEPS);
+#endif
+    printf("\n");
+    printf("PID_ScheduleLookup: %.2f ns/lookup", (ts1 - ts0) / BENCH_STEPS);
+#ifdef BENCH_HAVE_CYCLES
+    printf(", %.1f cycles/lookup", (double)(cs1 - cs0) / BENCH_STEPS);
+#endif
+    printf("\n");
+    printf("PID_BatchUpdate:    %.2f ns/loop", (tb1 - tb0) / ((double)batch_calls * BENCH_BATCH_LOOPS));
+#ifdef BENCH_HAVE_CYCLES
+    printf(", %.1f cycles/loop", (double)(cb1 - cb0) / ((double)batch_calls * BENCH_BATCH_LOOPS));
+#endif
+    printf(" (%s, %d loops per call)\n", PID_BatchImplementation(), BENCH_BATCH_LOOPS);
+
+    return 0;
+}
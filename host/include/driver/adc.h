@@ -0,0 +1,60 @@
+/*
+ *  Host stand-in for the ESP32 ADC1 driver. Conversions are served by a pluggable source function so experiments can
+ *  feed recorded or synthetic plant signals; by default channel 0 carries a sine and channel 1 a cosine
+ */
+
+#ifndef HOST_DRIVER_ADC_H
+#define HOST_DRIVER_ADC_H
+
+
+#include "esp_err.h"
+
+
+typedef enum {
+    ADC_UNIT_1 = 1,
+    ADC_UNIT_2 = 2
+} adc_unit_t;
+
+typedef enum {
+    ADC1_CHANNEL_0 = 0,
+    ADC1_CHANNEL_1,
+    ADC1_CHANNEL_2,
+    ADC1_CHANNEL_3,
+    ADC1_CHANNEL_4,
+    ADC1_CHANNEL_5,
+    ADC1_CHANNEL_6,
+    ADC1_CHANNEL_7,
+    ADC1_CHANNEL_MAX
+} adc1_channel_t;
+
+typedef enum {
+    ADC_WIDTH_BIT_9 = 0,
+    ADC_WIDTH_BIT_10,
+    ADC_WIDTH_BIT_11,
+    ADC_WIDTH_BIT_12,
+    ADC_WIDTH_MAX
+} adc_bits_width_t;
+
+typedef enum {
+    ADC_ATTEN_DB_0 = 0,
+    ADC_ATTEN_DB_2_5,
+    ADC_ATTEN_DB_6,
+    ADC_ATTEN_DB_11,
+    ADC_ATTEN_MAX
+} adc_atten_t;
+
+
+esp_err_t adc1_config_width(adc_bits_width_t width_bit);
+esp_err_t adc1_config_channel_atten(adc1_channel_t channel, adc_atten_t atten);
+int adc1_get_raw(adc1_channel_t channel);
+
+
+/*
+ *  Host only: replace the conversion source. The returned value is clipped to the configured width. Passing NULL
+ *  restores the default waveforms
+ */
+typedef int (*adc_fake_source_t)(adc1_channel_t channel, void *ctx);
+void adc_fake_set_source(adc_fake_source_t source, void *ctx);
+
+
+#endif /* HOST_DRIVER_ADC_H */
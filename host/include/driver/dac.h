@@ -0,0 +1,32 @@
+/*
+ *  Host stand-in for the ESP32 DAC driver. Written levels are kept so experiments can observe the controller output
+ */
+
+#ifndef HOST_DRIVER_DAC_H
+#define HOST_DRIVER_DAC_H
+
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+
+typedef enum {
+    DAC_CHANNEL_1 = 1,  // GPIO25
+    DAC_CHANNEL_2,  // GPIO26
+    DAC_CHANNEL_MAX
+} dac_channel_t;
+
+
+esp_err_t dac_output_enable(dac_channel_t channel);
+esp_err_t dac_output_disable(dac_channel_t channel);
+esp_err_t dac_output_voltage(dac_channel_t channel, uint8_t dac_value);
+
+
+/*
+ *  Host only: last level written to the channel
+ */
+uint8_t dac_fake_get_output(dac_channel_t channel);
+
+
+#endif /* HOST_DRIVER_DAC_H */
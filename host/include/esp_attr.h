@@ -0,0 +1,14 @@
+/*
+ *  Host stand-in for esp_attr.h: no IRAM/DRAM sections on the workstation
+ */
+
+#ifndef HOST_ESP_ATTR_H
+#define HOST_ESP_ATTR_H
+
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define RTC_DATA_ATTR
+
+
+#endif /* HOST_ESP_ATTR_H */
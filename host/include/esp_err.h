@@ -0,0 +1,34 @@
+/*
+ *  Host stand-in for esp_err.h
+ */
+
+#ifndef HOST_ESP_ERR_H
+#define HOST_ESP_ERR_H
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+
+typedef int32_t esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_NOT_SUPPORTED 0x106
+#define ESP_ERR_TIMEOUT 0x107
+
+#define ESP_ERROR_CHECK(x) do {                                                         \
+        esp_err_t __err_rc = (x);                                                       \
+        if (__err_rc != ESP_OK) {                                                       \
+            fprintf(stderr, "ESP_ERROR_CHECK failed: esp_err_t 0x%x at %s:%d (%s)\n",   \
+                    (unsigned)__err_rc, __FILE__, __LINE__, #x);                        \
+            abort();                                                                    \
+        }                                                                               \
+    } while (0)
+
+
+#endif /* HOST_ESP_ERR_H */
@@ -0,0 +1,46 @@
+/*
+ *  Host stand-in for the legacy esp_event_loop.h. Events are delivered synchronously to the registered handler from
+ *  the fake Wi-Fi driver (port/esp_system_stubs.c)
+ */
+
+#ifndef HOST_ESP_EVENT_LOOP_H
+#define HOST_ESP_EVENT_LOOP_H
+
+
+#include "esp_err.h"
+#include "tcpip_adapter.h"
+
+
+typedef enum {
+    SYSTEM_EVENT_WIFI_READY,
+    SYSTEM_EVENT_STA_START,
+    SYSTEM_EVENT_STA_STOP,
+    SYSTEM_EVENT_STA_CONNECTED,
+    SYSTEM_EVENT_STA_DISCONNECTED,
+    SYSTEM_EVENT_STA_GOT_IP,
+    SYSTEM_EVENT_STA_LOST_IP,
+    SYSTEM_EVENT_AP_STA_GOT_IP6,
+    SYSTEM_EVENT_MAX
+} system_event_id_t;
+
+typedef struct {
+    tcpip_adapter_if_t if_index;
+    tcpip_adapter_ip6_info_t ip6_info;
+} system_event_sta_got_ip6_t;
+
+typedef union {
+    system_event_sta_got_ip6_t got_ip6;
+} system_event_info_t;
+
+typedef struct {
+    system_event_id_t event_id;
+    system_event_info_t event_info;
+} system_event_t;
+
+typedef esp_err_t (*system_event_cb_t)(void *ctx, system_event_t *event);
+
+
+esp_err_t esp_event_loop_init(system_event_cb_t cb, void *ctx);
+
+
+#endif /* HOST_ESP_EVENT_LOOP_H */
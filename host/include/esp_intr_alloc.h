@@ -0,0 +1,13 @@
+/*
+ *  Host stand-in for esp_intr_alloc.h
+ */
+
+#ifndef HOST_ESP_INTR_ALLOC_H
+#define HOST_ESP_INTR_ALLOC_H
+
+
+#define ESP_INTR_FLAG_LEVEL1 (1<<1)
+#define ESP_INTR_FLAG_IRAM (1<<10)
+
+
+#endif /* HOST_ESP_INTR_ALLOC_H */
@@ -0,0 +1,46 @@
+/*
+ *  Host stand-in for esp_log.h. Messages go to stdout in the same "L (ms) tag: text" form as on the target
+ */
+
+#ifndef HOST_ESP_LOG_H
+#define HOST_ESP_LOG_H
+
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+
+typedef enum {
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE
+} esp_log_level_t;
+
+#ifndef LOG_LOCAL_LEVEL
+#define LOG_LOCAL_LEVEL CONFIG_LOG_DEFAULT_LEVEL
+#endif
+
+
+uint32_t esp_log_timestamp(void);
+
+
+#define ESP_LOG_LEVEL_LOCAL(level, letter, tag, format, ...) do {                                   \
+        if (LOG_LOCAL_LEVEL >= (level)) {                                                           \
+            printf(#letter " (%u) %s: " format "\n", (unsigned)esp_log_timestamp(), (tag), ##__VA_ARGS__); \
+            fflush(stdout);                                                                         \
+        }                                                                                           \
+    } while (0)
+
+#define ESP_LOGE(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_ERROR, E, tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_WARN, W, tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_INFO, I, tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_DEBUG, D, tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_VERBOSE, V, tag, format, ##__VA_ARGS__)
+
+
+#endif /* HOST_ESP_LOG_H */
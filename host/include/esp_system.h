@@ -0,0 +1,13 @@
+/*
+ *  Host stand-in for esp_system.h
+ */
+
+#ifndef HOST_ESP_SYSTEM_H
+#define HOST_ESP_SYSTEM_H
+
+
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+
+#endif /* HOST_ESP_SYSTEM_H */
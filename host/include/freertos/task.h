@@ -0,0 +1,29 @@
+/*
+ *  Host stand-in for FreeRTOS task API. Priorities and core affinity are accepted but not enforced
+ */
+
+#ifndef HOST_FREERTOS_TASK_H
+#define HOST_FREERTOS_TASK_H
+
+
+#include "freertos/FreeRTOS.h"
+
+
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pvTaskCode, const char * const pcName, const uint32_t usStackDepth,
+                                   void * const pvParameters, UBaseType_t uxPriority,
+                                   TaskHandle_t * const pvCreatedTask, const BaseType_t xCoreID);
+#define xTaskCreate(pvTaskCode, pcName, usStackDepth, pvParameters, uxPriority, pvCreatedTask) \
+    xTaskCreatePinnedToCore((pvTaskCode), (pcName), (usStackDepth), (pvParameters), (uxPriority), (pvCreatedTask), \
+                            tskNO_AFFINITY)
+void vTaskDelete(TaskHandle_t xTaskToDelete);
+
+void vTaskDelay(const TickType_t xTicksToDelay);
+void vTaskDelayUntil(TickType_t * const pxPreviousWakeTime, const TickType_t xTimeIncrement);
+TickType_t xTaskGetTickCount(void);
+
+
+#endif /* HOST_FREERTOS_TASK_H */
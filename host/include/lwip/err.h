@@ -0,0 +1,14 @@
+/*
+ *  Host stand-in for lwip/err.h
+ */
+
+#ifndef HOST_LWIP_ERR_H
+#define HOST_LWIP_ERR_H
+
+
+typedef signed char err_t;
+
+#define ERR_OK 0
+
+
+#endif /* HOST_LWIP_ERR_H */
@@ -0,0 +1,12 @@
+/*
+ *  Host stand-in for lwip/netdb.h
+ */
+
+#ifndef HOST_LWIP_NETDB_H
+#define HOST_LWIP_NETDB_H
+
+
+#include <netdb.h>
+
+
+#endif /* HOST_LWIP_NETDB_H */
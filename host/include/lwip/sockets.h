@@ -0,0 +1,40 @@
+/*
+ *  Host stand-in for lwIP sockets: the BSD sockets of the workstation plus the few lwIP-only helpers the firmware uses
+ */
+
+#ifndef HOST_LWIP_SOCKETS_H
+#define HOST_LWIP_SOCKETS_H
+
+
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+
+typedef struct {
+    uint32_t addr[4];
+} ip6_addr_t;
+
+
+// lwIP formats the address structure itself (both in_addr and its s_addr member are accepted)
+#define inet_ntoa_r(addr, buf, buflen) inet_ntop(AF_INET, &(addr), (buf), (buflen))
+#define inet6_ntoa_r(addr, buf, buflen) inet_ntop(AF_INET6, &(addr), (buf), (buflen))
+
+char *ip6addr_ntoa(const ip6_addr_t *addr);
+
+
+/*
+ *  lwIP takes the IP-level protocol number (IPPROTO_IP/IPPROTO_IPV6) for datagram sockets while Linux expects the
+ *  transport one, so socket() goes through the same lwip_socket() name the real compat macro uses
+ */
+int lwip_socket(int domain, int type, int protocol);
+#define socket(domain, type, protocol) lwip_socket((domain), (type), (protocol))
+
+
+#endif /* HOST_LWIP_SOCKETS_H */
@@ -0,0 +1,12 @@
+/*
+ *  Host stand-in for lwip/sys.h
+ */
+
+#ifndef HOST_LWIP_SYS_H
+#define HOST_LWIP_SYS_H
+
+
+#include "lwip/sockets.h"
+
+
+#endif /* HOST_LWIP_SYS_H */
@@ -0,0 +1,15 @@
+/*
+ *  Host stand-in for nvs_flash.h
+ */
+
+#ifndef HOST_NVS_FLASH_H
+#define HOST_NVS_FLASH_H
+
+
+#include "esp_err.h"
+
+
+esp_err_t nvs_flash_init(void);
+
+
+#endif /* HOST_NVS_FLASH_H */
@@ -0,0 +1,30 @@
+/*
+ *  Host stand-in for the ESP32 SYSCON registers. Only the SAR ADC pattern table fields used for the I2S-driven
+ *  scan are present; the fake I2S DMA (port/i2s_fake.c) scans through them as the hardware does
+ */
+
+#ifndef HOST_SOC_SYSCON_STRUCT_H
+#define HOST_SOC_SYSCON_STRUCT_H
+
+
+#include <stdint.h>
+
+
+typedef volatile struct {
+    union {
+        struct {
+            uint32_t reserved0: 15;
+            uint32_t sar1_patt_len: 4;
+            uint32_t sar2_patt_len: 4;
+            uint32_t reserved23: 9;
+        };
+        uint32_t val;
+    } saradc_ctrl;
+    uint32_t saradc_sar1_patt_tab[4];
+    uint32_t saradc_sar2_patt_tab[4];
+} syscon_dev_t;
+
+extern syscon_dev_t SYSCON;
+
+
+#endif /* HOST_SOC_SYSCON_STRUCT_H */
@@ -0,0 +1,28 @@
+/*
+ *  Host stand-in for tcpip_adapter.h. The workstation network stack is already up, so these are no-ops
+ */
+
+#ifndef HOST_TCPIP_ADAPTER_H
+#define HOST_TCPIP_ADAPTER_H
+
+
+#include "esp_err.h"
+#include "lwip/sockets.h"
+
+
+typedef enum {
+    TCPIP_ADAPTER_IF_STA,
+    TCPIP_ADAPTER_IF_AP,
+    TCPIP_ADAPTER_IF_MAX
+} tcpip_adapter_if_t;
+
+typedef struct {
+    ip6_addr_t ip;
+} tcpip_adapter_ip6_info_t;
+
+
+void tcpip_adapter_init(void);
+esp_err_t tcpip_adapter_create_ip6_linklocal(tcpip_adapter_if_t tcpip_if);
+
+
+#endif /* HOST_TCPIP_ADAPTER_H */
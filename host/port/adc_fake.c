@@ -0,0 +1,74 @@
+/*
+ *  Fake ADC1: conversions come from a replaceable source function, by default a pair of slow quadrature waveforms
+ *  spanning the configured range
+ */
+
+#include <math.h>
+#include <time.h>
+
+#include "driver/adc.h"
+
+
+#define DEFAULT_SOURCE_PERIOD_S 2.0
+
+
+static adc_bits_width_t adc_width = ADC_WIDTH_BIT_12;
+
+static adc_fake_source_t adc_source = NULL;
+static void *adc_source_ctx = NULL;
+
+
+static int _default_source(adc1_channel_t channel, void *ctx) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double const phase = 2.0 * M_PI * fmod(now.tv_sec + now.tv_nsec * 1e-9, DEFAULT_SOURCE_PERIOD_S) /
+                         DEFAULT_SOURCE_PERIOD_S;
+    double const full_scale = (double)((1 << (9 + adc_width)) - 1);
+
+    switch (channel) {
+        case ADC1_CHANNEL_0:
+            return (int)(full_scale * (0.5 + 0.5*sin(phase)));
+        case ADC1_CHANNEL_1:
+            return (int)(full_scale * (0.5 + 0.5*cos(phase)));
+        default:
+            return (int)(full_scale / 2);
+    }
+}
+
+
+esp_err_t adc1_config_width(adc_bits_width_t width_bit) {
+    if (width_bit >= ADC_WIDTH_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    adc_width = width_bit;
+    return ESP_OK;
+}
+
+esp_err_t adc1_config_channel_atten(adc1_channel_t channel, adc_atten_t atten) {
+    if (channel >= ADC1_CHANNEL_MAX || atten >= ADC_ATTEN_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
+
+int adc1_get_raw(adc1_channel_t channel) {
+    if (channel >= ADC1_CHANNEL_MAX) {
+        return -1;
+    }
+
+    int const max_raw = (1 << (9 + adc_width)) - 1;
+    int raw = (adc_source != NULL) ? adc_source(channel, adc_source_ctx) : _default_source(channel, NULL);
+    if (raw < 0) {
+        raw = 0;
+    }
+    else if (raw > max_raw) {
+        raw = max_raw;
+    }
+    return raw;
+}
+
+
+void adc_fake_set_source(adc_fake_source_t source, void *ctx) {
+    adc_source_ctx = ctx;
+    adc_source = source;
+}
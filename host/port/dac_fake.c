@@ -0,0 +1,29 @@
+/*
+ *  Fake DAC: remembers the last written level of each channel
+ */
+
+#include "driver/dac.h"
+
+
+static volatile uint8_t dac_levels[DAC_CHANNEL_MAX];
+
+
+esp_err_t dac_output_enable(dac_channel_t channel) {
+    return (channel >= DAC_CHANNEL_1 && channel < DAC_CHANNEL_MAX) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t dac_output_disable(dac_channel_t channel) {
+    return dac_output_enable(channel);
+}
+
+esp_err_t dac_output_voltage(dac_channel_t channel, uint8_t dac_value) {
+    if (channel < DAC_CHANNEL_1 || channel >= DAC_CHANNEL_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    dac_levels[channel] = dac_value;
+    return ESP_OK;
+}
+
+uint8_t dac_fake_get_output(dac_channel_t channel) {
+    return (channel >= DAC_CHANNEL_1 && channel < DAC_CHANNEL_MAX) ? dac_levels[channel] : 0;
+}
@@ -0,0 +1,97 @@
+/*
+ *  Stand-ins for the ESP-IDF system services the firmware touches during start-up: NVS, event loop, TCP/IP adapter
+ *  and a Wi-Fi station that "connects" instantly
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "esp_system.h"
+#include "esp_log.h"
+#include "esp_wifi.h"
+#include "esp_event_loop.h"
+#include "nvs_flash.h"
+
+
+static const char *TAG_HOST = "host";
+
+
+uint32_t esp_log_timestamp(void) {
+    static struct timespec origin;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (origin.tv_sec == 0 && origin.tv_nsec == 0) {
+        origin = now;
+    }
+    return (uint32_t)((now.tv_sec - origin.tv_sec) * 1000 + (now.tv_nsec - origin.tv_nsec) / 1000000);
+}
+
+
+esp_err_t nvs_flash_init(void) {
+    return ESP_OK;
+}
+
+
+void tcpip_adapter_init(void) {}
+
+esp_err_t tcpip_adapter_create_ip6_linklocal(tcpip_adapter_if_t tcpip_if) {
+    return ESP_OK;
+}
+
+char *ip6addr_ntoa(const ip6_addr_t *addr) {
+    static char str[INET6_ADDRSTRLEN];
+    return (char *)inet_ntop(AF_INET6, addr, str, sizeof(str));
+}
+
+
+static system_event_cb_t event_cb = NULL;
+static void *event_ctx = NULL;
+
+static void _post_event(system_event_id_t event_id) {
+    system_event_t event;
+    memset(&event, 0, sizeof(event));
+    event.event_id = event_id;
+    if (event_id == SYSTEM_EVENT_AP_STA_GOT_IP6) {
+        event.event_info.got_ip6.if_index = TCPIP_ADAPTER_IF_STA;
+        memcpy(&event.event_info.got_ip6.ip6_info.ip, &in6addr_loopback, sizeof(ip6_addr_t));
+    }
+    if (event_cb != NULL) {
+        event_cb(event_ctx, &event);
+    }
+}
+
+esp_err_t esp_event_loop_init(system_event_cb_t cb, void *ctx) {
+    event_cb = cb;
+    event_ctx = ctx;
+    return ESP_OK;
+}
+
+
+esp_err_t esp_wifi_init(const wifi_init_config_t *config) {
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_storage(wifi_storage_t storage) {
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode) {
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_config(esp_interface_t interface, wifi_config_t *conf) {
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_start(void) {
+    _post_event(SYSTEM_EVENT_STA_START);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_connect(void) {
+    ESP_LOGI(TAG_HOST, "Wi-Fi station stand-in: using the workstation network");
+    _post_event(SYSTEM_EVENT_STA_CONNECTED);
+    _post_event(SYSTEM_EVENT_STA_GOT_IP);
+    _post_event(SYSTEM_EVENT_AP_STA_GOT_IP6);
+    return ESP_OK;
+}
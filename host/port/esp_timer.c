@@ -0,0 +1,134 @@
+/*
+ *  esp_timer stand-in on CLOCK_MONOTONIC. A periodic timer is a thread waiting for absolute deadlines; as on the
+ *  target, alarms are spaced from the previous due time, so late callbacks are followed by back-to-back catch-ups
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+#include <errno.h>
+
+#include "esp_timer.h"
+
+
+struct esp_timer {
+    esp_timer_create_args_t args;
+    uint64_t period_us;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    bool running;
+};
+
+
+static struct timespec timer_origin;
+static pthread_once_t timer_origin_once = PTHREAD_ONCE_INIT;
+
+static void _timer_origin_init(void) {
+    clock_gettime(CLOCK_MONOTONIC, &timer_origin);
+}
+
+
+int64_t esp_timer_get_time(void) {
+    pthread_once(&timer_origin_once, _timer_origin_init);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)(now.tv_sec - timer_origin.tv_sec) * 1000000 + (now.tv_nsec - timer_origin.tv_nsec) / 1000;
+}
+
+
+static void *_timer_thread(void *arg) {
+    esp_timer_handle_t timer = arg;
+
+    int64_t due_us = esp_timer_get_time() + timer->period_us;
+
+    pthread_mutex_lock(&timer->lock);
+    while (timer->running) {
+        int64_t const abs_ns = ((int64_t)timer_origin.tv_sec * 1000000 + timer_origin.tv_nsec / 1000 + due_us) * 1000;
+        struct timespec const deadline = { .tv_sec = abs_ns / 1000000000, .tv_nsec = abs_ns % 1000000000 };
+        if (pthread_cond_timedwait(&timer->changed, &timer->lock, &deadline) != ETIMEDOUT) {
+            continue;  // stopped or spurious wake-up, re-check
+        }
+
+        pthread_mutex_unlock(&timer->lock);
+        timer->args.callback(timer->args.arg);
+        pthread_mutex_lock(&timer->lock);
+
+        due_us += timer->period_us;
+    }
+    pthread_mutex_unlock(&timer->lock);
+
+    return NULL;
+}
+
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle) {
+    if (create_args == NULL || create_args->callback == NULL || out_handle == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_timer_handle_t timer = calloc(1, sizeof(struct esp_timer));
+    if (timer == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    timer->args = *create_args;
+    pthread_mutex_init(&timer->lock, NULL);
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&timer->changed, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    *out_handle = timer;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period) {
+    pthread_once(&timer_origin_once, _timer_origin_init);
+
+    pthread_mutex_lock(&timer->lock);
+    if (timer->running) {
+        pthread_mutex_unlock(&timer->lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->period_us = period;
+    timer->running = true;
+    pthread_mutex_unlock(&timer->lock);
+
+    if (pthread_create(&timer->thread, NULL, _timer_thread, timer) != 0) {
+        timer->running = false;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    pthread_mutex_lock(&timer->lock);
+    if (!timer->running) {
+        pthread_mutex_unlock(&timer->lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->running = false;
+    pthread_cond_broadcast(&timer->changed);
+    pthread_mutex_unlock(&timer->lock);
+
+    if (!pthread_equal(pthread_self(), timer->thread)) {
+        pthread_join(timer->thread, NULL);
+    }
+    else {
+        pthread_detach(timer->thread);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+    if (timer->running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    pthread_mutex_destroy(&timer->lock);
+    pthread_cond_destroy(&timer->changed);
+    free(timer);
+    return ESP_OK;
+}
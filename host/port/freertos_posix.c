@@ -0,0 +1,179 @@
+/*
+ *  FreeRTOS stand-in on top of POSIX threads. Every task is a detached pthread, ticks are derived from
+ *  CLOCK_MONOTONIC at configTICK_RATE_HZ
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include <errno.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+
+
+#define NSEC_PER_SEC 1000000000LL
+#define NSEC_PER_TICK (NSEC_PER_SEC / configTICK_RATE_HZ)
+
+
+static struct timespec tick_origin;
+static pthread_once_t tick_origin_once = PTHREAD_ONCE_INIT;
+
+static void _tick_origin_init(void) {
+    clock_gettime(CLOCK_MONOTONIC, &tick_origin);
+}
+
+static long long _ns_since_origin(void) {
+    pthread_once(&tick_origin_once, _tick_origin_init);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - tick_origin.tv_sec) * NSEC_PER_SEC + (now.tv_nsec - tick_origin.tv_nsec);
+}
+
+static void _sleep_until_ns(long long ns) {
+    pthread_once(&tick_origin_once, _tick_origin_init);
+    long long abs_ns = tick_origin.tv_sec * NSEC_PER_SEC + tick_origin.tv_nsec + ns;
+    struct timespec deadline = { .tv_sec = abs_ns / NSEC_PER_SEC, .tv_nsec = abs_ns % NSEC_PER_SEC };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+}
+
+
+typedef struct {
+    TaskFunction_t code;
+    void *params;
+} task_start_t;
+
+static void *_task_trampoline(void *arg) {
+    task_start_t start = *(task_start_t *)arg;
+    free(arg);
+    start.code(start.params);
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pvTaskCode, const char * const pcName, const uint32_t usStackDepth,
+                                   void * const pvParameters, UBaseType_t uxPriority,
+                                   TaskHandle_t * const pvCreatedTask, const BaseType_t xCoreID) {
+
+    task_start_t *start = malloc(sizeof(task_start_t));
+    if (start == NULL) {
+        return pdFAIL;
+    }
+    start->code = pvTaskCode;
+    start->params = pvParameters;
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int err = pthread_create(&thread, &attr, _task_trampoline, start);
+    pthread_attr_destroy(&attr);
+    if (err != 0) {
+        free(start);
+        return pdFAIL;
+    }
+
+    if (pvCreatedTask != NULL) {
+        *pvCreatedTask = (TaskHandle_t)thread;
+    }
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t xTaskToDelete) {
+    // only self-deletion is used by the firmware
+    if (xTaskToDelete == NULL) {
+        pthread_exit(NULL);
+    }
+}
+
+
+TickType_t xTaskGetTickCount(void) {
+    return (TickType_t)(_ns_since_origin() / NSEC_PER_TICK);
+}
+
+/*
+ *  As on the target, blocking ends at a tick boundary rather than a whole number of tick periods after the call
+ */
+void vTaskDelay(const TickType_t xTicksToDelay) {
+    long long const now_ns = _ns_since_origin();
+    _sleep_until_ns((now_ns / NSEC_PER_TICK + xTicksToDelay) * NSEC_PER_TICK);
+}
+
+void vTaskDelayUntil(TickType_t * const pxPreviousWakeTime, const TickType_t xTimeIncrement) {
+    long long const now_ns = _ns_since_origin();
+    TickType_t const now = (TickType_t)(now_ns / NSEC_PER_TICK);
+    TickType_t const wake_time = *pxPreviousWakeTime + xTimeIncrement;
+
+    // as FreeRTOS does, do not block if the wake time is already in the past (taking tick counter overflow into
+    // account)
+    if ((TickType_t)(wake_time - *pxPreviousWakeTime) > (TickType_t)(now - *pxPreviousWakeTime)) {
+        _sleep_until_ns((now_ns / NSEC_PER_TICK + (TickType_t)(wake_time - now)) * NSEC_PER_TICK);
+    }
+    *pxPreviousWakeTime = wake_time;
+}
+
+
+struct EventGroupDef_t {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    EventBits_t bits;
+};
+
+EventGroupHandle_t xEventGroupCreate(void) {
+    EventGroupHandle_t group = calloc(1, sizeof(struct EventGroupDef_t));
+    if (group != NULL) {
+        pthread_mutex_init(&group->lock, NULL);
+        pthread_cond_init(&group->changed, NULL);
+    }
+    return group;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToSet) {
+    pthread_mutex_lock(&xEventGroup->lock);
+    xEventGroup->bits |= uxBitsToSet;
+    EventBits_t bits = xEventGroup->bits;
+    pthread_cond_broadcast(&xEventGroup->changed);
+    pthread_mutex_unlock(&xEventGroup->lock);
+    return bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToClear) {
+    pthread_mutex_lock(&xEventGroup->lock);
+    EventBits_t bits = xEventGroup->bits;
+    xEventGroup->bits &= ~uxBitsToClear;
+    pthread_mutex_unlock(&xEventGroup->lock);
+    return bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToWaitFor,
+                                const BaseType_t xClearOnExit, const BaseType_t xWaitForAllBits,
+                                TickType_t xTicksToWait) {
+
+    struct timespec deadline;
+    if (xTicksToWait != portMAX_DELAY) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        long long abs_ns = deadline.tv_sec * NSEC_PER_SEC + deadline.tv_nsec + (long long)xTicksToWait * NSEC_PER_TICK;
+        deadline.tv_sec = abs_ns / NSEC_PER_SEC;
+        deadline.tv_nsec = abs_ns % NSEC_PER_SEC;
+    }
+
+    pthread_mutex_lock(&xEventGroup->lock);
+    while (1) {
+        EventBits_t const matched = xEventGroup->bits & uxBitsToWaitFor;
+        if (xWaitForAllBits ? (matched == uxBitsToWaitFor) : (matched != 0)) {
+            break;
+        }
+        if (xTicksToWait == portMAX_DELAY) {
+            pthread_cond_wait(&xEventGroup->changed, &xEventGroup->lock);
+        }
+        else if (pthread_cond_timedwait(&xEventGroup->changed, &xEventGroup->lock, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    EventBits_t bits = xEventGroup->bits;
+    if (xClearOnExit) {
+        xEventGroup->bits &= ~uxBitsToWaitFor;
+    }
+    pthread_mutex_unlock(&xEventGroup->lock);
+    return bits;
+}
@@ -0,0 +1,138 @@
+/*
+ *  Fake I2S DMA in the built-in ADC mode. Conversions are produced in real time at the configured sample rate by
+ *  walking the SAR1 pattern table, so the firmware's scan list set-up is exercised the same way as on the target. As
+ *  the real DMA, the fake only keeps dma_buf_count buffers: data older than that is lost if the reader falls behind
+ */
+
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+
+#include "driver/i2s.h"
+#include "soc/syscon_struct.h"
+
+
+#define NSEC_PER_SEC 1000000000LL
+
+
+syscon_dev_t SYSCON;
+
+
+static i2s_config_t i2s_adc_config;
+static bool i2s_installed = false;
+static bool i2s_adc_enabled = false;
+static adc1_channel_t i2s_adc_channel = ADC1_CHANNEL_0;
+
+static long long next_word_ns = 0;
+static uint32_t pattern_pos = 0;
+
+
+static long long _now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+}
+
+static void _sleep_until_ns(long long abs_ns) {
+    struct timespec const deadline = { .tv_sec = abs_ns / NSEC_PER_SEC, .tv_nsec = abs_ns % NSEC_PER_SEC };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+}
+
+/*
+ *  As the driver does, the ADC mode starts with a single-entry pattern (12 bits, 11 dB) for the selected channel
+ */
+static void _single_channel_pattern(adc1_channel_t channel) {
+    SYSCON.saradc_ctrl.sar1_patt_len = 0;
+    SYSCON.saradc_sar1_patt_tab[0] = (uint32_t)(((channel & 0xF) << 4) | (ADC_WIDTH_BIT_12 << 2) | ADC_ATTEN_DB_11)
+                                     << 24;
+}
+
+static uint8_t _pattern_entry(uint32_t pos) {
+    return (SYSCON.saradc_sar1_patt_tab[pos / 4] >> ((3 - (pos % 4)) * 8)) & 0xFF;
+}
+
+
+esp_err_t i2s_driver_install(i2s_port_t i2s_num, const i2s_config_t *i2s_config, int queue_size, void *i2s_queue) {
+    if ((i2s_num != I2S_NUM_0) || (i2s_config == NULL) || !(i2s_config->mode & I2S_MODE_ADC_BUILT_IN) ||
+        (i2s_config->sample_rate <= 0) || (i2s_config->dma_buf_count < 2) || (i2s_config->dma_buf_len <= 0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (i2s_installed) {
+        return ESP_FAIL;
+    }
+    i2s_adc_config = *i2s_config;
+    i2s_installed = true;
+    return ESP_OK;
+}
+
+esp_err_t i2s_driver_uninstall(i2s_port_t i2s_num) {
+    i2s_installed = false;
+    i2s_adc_enabled = false;
+    return ESP_OK;
+}
+
+esp_err_t i2s_set_adc_mode(adc_unit_t adc_unit, adc1_channel_t adc_channel) {
+    if ((adc_unit != ADC_UNIT_1) || (adc_channel >= ADC1_CHANNEL_MAX)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    i2s_adc_channel = adc_channel;
+    _single_channel_pattern(adc_channel);
+    return ESP_OK;
+}
+
+esp_err_t i2s_adc_enable(i2s_port_t i2s_num) {
+    if (!i2s_installed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    _single_channel_pattern(i2s_adc_channel);
+    pattern_pos = 0;
+    next_word_ns = _now_ns();
+    i2s_adc_enabled = true;
+    return ESP_OK;
+}
+
+esp_err_t i2s_adc_disable(i2s_port_t i2s_num) {
+    i2s_adc_enabled = false;
+    return ESP_OK;
+}
+
+
+/*
+ *  Blocks until a whole DMA buffer worth of conversions (or the requested size, if smaller) is available
+ */
+esp_err_t i2s_read(i2s_port_t i2s_num, void *dest, size_t size, size_t *bytes_read, TickType_t ticks_to_wait) {
+    *bytes_read = 0;
+    if (!i2s_adc_enabled) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    size_t words = size / sizeof(uint16_t);
+    if (words > (size_t)i2s_adc_config.dma_buf_len) {
+        words = i2s_adc_config.dma_buf_len;
+    }
+    long long const word_ns = NSEC_PER_SEC / i2s_adc_config.sample_rate;
+    long long const ring_ns = word_ns * i2s_adc_config.dma_buf_len * i2s_adc_config.dma_buf_count;
+
+    // reader has fallen behind more than the DMA ring holds: the oldest buffers are overwritten
+    long long const now_ns = _now_ns();
+    if (now_ns - next_word_ns > ring_ns) {
+        long long const lost_words = (now_ns - next_word_ns - ring_ns) / word_ns;
+        pattern_pos += lost_words;
+        next_word_ns += lost_words * word_ns;
+    }
+
+    long long const ready_ns = next_word_ns + (long long)words * word_ns;
+    _sleep_until_ns(ready_ns);
+
+    uint16_t *words_dest = dest;
+    uint32_t const pattern_len = SYSCON.saradc_ctrl.sar1_patt_len + 1;
+    for (size_t i = 0; i < words; i++) {
+        uint8_t const entry = _pattern_entry(pattern_pos++ % pattern_len);
+        adc1_channel_t const channel = entry >> 4;
+        words_dest[i] = (uint16_t)((channel << 12) | (adc1_get_raw(channel) & 0xFFF));
+    }
+    next_word_ns = ready_ns;
+
+    *bytes_read = words * sizeof(uint16_t);
+    return ESP_OK;
+}
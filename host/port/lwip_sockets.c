@@ -0,0 +1,15 @@
+/*
+ *  lwIP socket API quirks mapped onto the workstation sockets
+ */
+
+#include "lwip/sockets.h"
+
+#undef socket
+
+
+int lwip_socket(int domain, int type, int protocol) {
+    if (protocol == IPPROTO_IP || protocol == IPPROTO_IPV6) {
+        protocol = 0;
+    }
+    return socket(domain, type, protocol);
+}
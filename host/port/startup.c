@@ -0,0 +1,21 @@
+/*
+ *  Host entry point: plays the role of the ESP-IDF start-up code, i.e. runs app_main() and keeps the "scheduler"
+ *  (the other threads) alive afterwards
+ */
+
+#include <unistd.h>
+
+
+void app_main(void);
+
+
+int main(void) {
+
+    app_main();
+
+    while (1) {
+        pause();
+    }
+
+    return 0;
+}
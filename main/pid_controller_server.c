@@ -11,6 +11,7 @@
 #include "esp_wifi.h"
 #include "esp_event_loop.h"
 #include "nvs_flash.h"
+#include "esp_timer.h"
 
 #include "driver/adc.h"
 
@@ -19,20 +20,23 @@
 #include "lwip/sys.h"
 #include <lwip/netdb.h>
 
+#if defined(__has_include) && __has_include("../../my_wifi.h")
 #include "../../my_wifi.h"  // hide personal data from the repository
+#else
+#define MY_SSID CONFIG_WIFI_SSID
+#define MY_PSWD CONFIG_WIFI_PASSWORD
+#endif
 #include "commandmanager.h"
 #include "pid.h"
+#include "controlloop.h"
+#include "sampler.h"
+#include "binlog.h"
+#include "stream.h"
 
 
 #define UDP_PORT 1200
 
 
-#define REQUEST_RESPONSE_BUF_SIZE (sizeof(char)+2*(sizeof(float)))  // same size for both requests and responses
-#define SERVER_TASK_SLEEP_TIME_MS 20  // values smaller than 20 ms lead to not working no_msg_timeout
-#define NO_MSG_TIMEOUT_SECONDS 15.0
-
-
-
 /*
  *  FreeRTOS event group to signal when we are connected & ready to make a request
  */
@@ -78,10 +82,6 @@ static esp_err_t event_handler(void *ctx, system_event_t *event) {
 
 
 
-int sock;
-struct sockaddr_in6 sourceAddr;
-socklen_t socklen;
-
 static void udp_server_task(void *pvParameters) {
     
     char buf[REQUEST_RESPONSE_BUF_SIZE];
@@ -102,7 +102,7 @@ static void udp_server_task(void *pvParameters) {
             inet_ntoa_r(destAddr.sin_addr, addr_str, sizeof(addr_str) - 1);
         #else // IPV6
             struct sockaddr_in6 destAddr;
-            bzero(&destAddr.sin6_addr.un, sizeof(destAddr.sin6_addr.un));
+            memset(&destAddr.sin6_addr, 0, sizeof(destAddr.sin6_addr));
             destAddr.sin6_family = AF_INET6;
             destAddr.sin6_port = htons(UDP_PORT);
             addr_family = AF_INET6;
@@ -110,7 +110,7 @@ static void udp_server_task(void *pvParameters) {
             inet6_ntoa_r(destAddr.sin6_addr, addr_str, sizeof(addr_str) - 1);
         #endif
 
-        sock = socket(addr_family, SOCK_DGRAM, ip_protocol);
+        int sock = socket(addr_family, SOCK_DGRAM, ip_protocol);
         if (sock < 0) {
             ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
             break;
@@ -123,73 +123,74 @@ static void udp_server_task(void *pvParameters) {
         }
         ESP_LOGI(TAG, "Socket binded");
 
-        int no_msg_cnt = 0;
-        int const no_msg_cnt_warn = NO_MSG_TIMEOUT_SECONDS*(1000.0/SERVER_TASK_SLEEP_TIME_MS);
-        bool is_stream_stop = false;
-
-        while (1) {
-
-            if ((no_msg_cnt >= no_msg_cnt_warn) && (!is_stream_stop)) {
-                ESP_LOGI(TAG, "No incoming messages within a timeout, stop the stream");
-                stream_stop();
-                is_stream_stop = true;
+        bool sock_error = false;
+
+        while (!sock_error) {
+
+            /*
+             *  Serve the streams (what is due and the leases of silent clients), then sleep in select() until either
+             *  a datagram arrives or the nearest of their deadlines passes. Without clients there is no deadline
+             */
+            int64_t const now_us = esp_timer_get_time();
+            int64_t const wake_us = stream_service(sock, now_us);
+
+            fd_set read_set;
+            FD_ZERO(&read_set);
+            FD_SET(sock, &read_set);
+            struct timeval timeout;
+            if (wake_us >= 0) {
+                int64_t const sleep_us = MAX(wake_us - now_us, 0);
+                timeout.tv_sec = sleep_us / 1000000;
+                timeout.tv_usec = sleep_us % 1000000;
+            }
+            int const ready = select(sock + 1, &read_set, NULL, NULL, (wake_us >= 0) ? &timeout : NULL);
+            if (ready < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                ESP_LOGE(TAG, "select failed: errno %d", errno);
+                break;
+            }
+            if (ready == 0) {
+                continue;  // a deadline has passed
             }
 
-            /* Check for available data in socket. Make sure you have CONFIG_LWIP_SO_RCVBUF option set to 'y'
-            in your sdkconfig */
-            int data_len = 0;
-            ioctl(sock, FIONREAD, &data_len);
-            // if (err < 0) {
-            //     ESP_LOGE(TAG, "ioctl: errno %d", errno);
-            // }
-            if (data_len > 0) {
+            // drain every datagram queued since the last wakeup before going back to sleep
+            while (1) {
                 /*
                 *  recvfrom: receive a UDP datagram from a client
                 *  len: message byte size
                 */
-                // ESP_LOGI(TAG, "New data");
-                // struct sockaddr_in6 sourceAddr;  // large enough for both IPv4 or IPv6
-                socklen = sizeof(sourceAddr);
-                int len = recvfrom(sock, buf, REQUEST_RESPONSE_BUF_SIZE, 0, (struct sockaddr *)&sourceAddr, &socklen);
+                struct sockaddr_in6 sourceAddr;  // large enough for both IPv4 or IPv6
+                socklen_t socklen = sizeof(sourceAddr);
+                int len = recvfrom(sock, buf, REQUEST_RESPONSE_BUF_SIZE, MSG_DONTWAIT, (struct sockaddr *)&sourceAddr,
+                                   &socklen);
 
-                // error occured during receiving
                 if (len < 0) {
-                    // ESP_LOGE(TAG, "recvfrom failed: errno %d", errno);
+                    // error occured during receiving (as opposed to the queue just being empty)
+                    if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+                        ESP_LOGE(TAG, "recvfrom failed: errno %d", errno);
+                        sock_error = true;
+                    }
                     break;
                 }
-                // data received
-                else {
-                    // get the sender's ip address
-                    if (sourceAddr.sin6_family == PF_INET) {
-                        inet_ntoa_r(((struct sockaddr_in *)&sourceAddr)->sin_addr.s_addr, addr_str, sizeof(addr_str) - 1);
-                    }
-                    else if (sourceAddr.sin6_family == PF_INET6) {
-                        inet6_ntoa_r(sourceAddr.sin6_addr, addr_str, sizeof(addr_str) - 1);
-                    }
 
-                    // ESP_LOGI(TAG, "Received %d bytes from %s", len, addr_str);
-                    // ESP_LOGI(TAG, "%s", buf);
+                // get the sender's ip address
+                if (sourceAddr.sin6_family == PF_INET) {
+                    inet_ntoa_r(((struct sockaddr_in *)&sourceAddr)->sin_addr.s_addr, addr_str, sizeof(addr_str) - 1);
+                }
+                else if (sourceAddr.sin6_family == PF_INET6) {
+                    inet6_ntoa_r(sourceAddr.sin6_addr, addr_str, sizeof(addr_str) - 1);
+                }
 
-                    process_request((unsigned char *)buf);
+                // ESP_LOGI(TAG, "Received %d bytes from %s", len, addr_str);
 
-                    sendto(sock, buf, REQUEST_RESPONSE_BUF_SIZE, 0, (struct sockaddr *)&sourceAddr, socklen);
-                    // if (err < 0) {
-                    //     ESP_LOGE(TAG, "Error occured during sending: errno %d", errno);
-                    //     break;
-                    // }
+                stream_touch((struct sockaddr *)&sourceAddr);
+                process_request((unsigned char *)buf, &len, (struct sockaddr *)&sourceAddr, socklen);
 
-                    memset(buf, 0, REQUEST_RESPONSE_BUF_SIZE);
+                sendto(sock, buf, len, 0, (struct sockaddr *)&sourceAddr, socklen);
 
-                    no_msg_cnt = 0;
-                    is_stream_stop = false;                    
-                }
-            }
-            // No available data
-            else {
-                if (!is_stream_stop) {
-                    no_msg_cnt++;
-                }
-                vTaskDelay(pdMS_TO_TICKS(SERVER_TASK_SLEEP_TIME_MS));
+                memset(buf, 0, REQUEST_RESPONSE_BUF_SIZE);
             }
         }
 
@@ -210,6 +211,8 @@ void app_main() {
 
     ESP_ERROR_CHECK( nvs_flash_init() );
 
+    binlog_start();
+
 
     /*
      *  Initialize Wi-Fi
@@ -242,11 +245,11 @@ void app_main() {
 
 
     /*
-     *  ADC setup
+     *  ADC setup: continuous (DMA) sampling of the process variable (channel 0) and the auxiliary input (channel 1)
      */
     adc1_config_width(ADC_WIDTH_BIT_12);
-    adc1_config_channel_atten(ADC1_CHANNEL_0, ADC_ATTEN_DB_0);
-    adc1_config_channel_atten(ADC1_CHANNEL_1, ADC_ATTEN_DB_0);
+    adc1_channel_t const adc_scan_list[] = { ADC1_CHANNEL_0, ADC1_CHANNEL_1 };
+    ESP_ERROR_CHECK( sampler_start(adc_scan_list, sizeof(adc_scan_list)/sizeof(adc_scan_list[0]), ADC_ATTEN_DB_0) );
 
 
     /*
@@ -260,6 +263,7 @@ void app_main() {
     // PID_SetPID(p_pid_data, );
 
 
+    controlloop_start();
+
     xTaskCreate(udp_server_task, "udp_server_task", 4096, NULL, 5, NULL);
-    xTaskCreate(_stream_task, "_stream_task", 4096, NULL, 4, NULL);
 }